@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Time ranked, stage by stage, on synthetic elections from gen.
+#
+# Usage: sh bench.sh [candidates...]
+#
+# Builds ranked and gen in a scratch directory, then runs each model
+# over a grid of candidate and voter counts, in line mode and, for the
+# smaller elections, column mode.  The seeds are fixed, so the same
+# tree always gets the same elections.  Prints what ranked -T reports,
+# one line per stage and one per hot call count:
+#
+#	model candidates voters mode stage name seconds kbytes
+#	model candidates voters mode count name n
+#
+# Set CC, CFLAGS, VOTERS or MODELS in the environment to change them.
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -march=native -pthread}
+VOTERS=${VOTERS:-"1000 100000 1000000"}
+MODELS=${MODELS:-"ic mallows cyclic truncated"}
+CANDIDATES=${*:-"5 20 100"}
+COLUMN_MAX=10000
+
+dir=$(dirname "$0")
+tmp=${TMPDIR:-/tmp}/bench.$$
+trap 'rm -rf $tmp' 0 1 2 15
+mkdir -p $tmp || exit 1
+$CC $CFLAGS -o $tmp/ranked "$dir/ranked.c" "$dir/libranked.c" -lm || exit 1
+$CC $CFLAGS -o $tmp/gen "$dir/gen.c" || exit 1
+
+for model in $MODELS; do
+	case $model in
+	truncated)	gen="-m ic -t 5" ;;
+	mallows)	gen="-m mallows -p 0.8" ;;
+	*)		gen="-m $model" ;;
+	esac
+	for c in $CANDIDATES; do
+		for v in $VOTERS; do
+			$tmp/gen $gen -c $c -n $v -s $c$v > $tmp/lines.csv
+			$tmp/ranked -T -b < $tmp/lines.csv 2>&1 >/dev/null |
+				awk -v p="$model $c $v line" '$1 == "stage" || $1 == "count" { $1 = p " " $1; print }'
+			[ $v -le $COLUMN_MAX ] || continue
+			$tmp/gen $gen -c $c -n $v -s $c$v -k > $tmp/columns.csv
+			$tmp/ranked -T < $tmp/columns.csv 2>&1 >/dev/null |
+				awk -v p="$model $c $v column" '$1 == "stage" || $1 == "count" { $1 = p " " $1; print }'
+		done
+	done
+done
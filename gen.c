@@ -0,0 +1,319 @@
+/*
+ * Generate a synthetic election, for testing and timing ranked.
+ *
+ * Writes a csv file on stdout, one ballot per line, in the form
+ * ranked -b reads: a line of candidate names, then each ballot's
+ * candidates, best first.  With -k it writes the column form instead.
+ *
+ * The ballots are drawn from one of these models:
+ *	ic	impartial culture: every order is equally likely.
+ *	mallows	orders near c1, c2, ... cN, each swap away from it less
+ *		likely by a factor of phi (-p).  phi 1 is impartial culture,
+ *		phi near 0 is nearly unanimous.
+ *	cyclic	the candidates are split into three blocks A, B and C,
+ *		and the voters into three groups ranking them ABC, BCA and
+ *		CAB, so the majorities go round in a circle.
+ * With -t N, each ballot then ranks only its first 1 to N candidates.
+ *
+ * The same seed (-s) always gives the same election.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdint.h>
+
+char *myname;
+
+int num_candidates;
+int num_voters;
+int truncate_at;
+int column_mode;
+double phi;
+uint64_t seed;
+
+#define	MODEL_IC	0
+#define	MODEL_MALLOWS	1
+#define	MODEL_CYCLIC	2
+int model;
+
+char *model_names[] = {
+	"ic",
+	"mallows",
+	"cyclic",
+};
+
+/*
+ * splitmix64.  Small, and gives the same numbers everywhere.
+ */
+static uint64_t
+rand64()
+{
+	uint64_t z;
+
+	z = (seed += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*
+ * A number in [0, n).
+ */
+static int
+rand_below(int n)
+{
+	return (int)(rand64() % (uint64_t)n);
+}
+
+/*
+ * A number in [0, 1).
+ */
+static double
+rand_unit()
+{
+	return (rand64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void
+shuffle(int *v, int n)
+{
+	int i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = rand_below(i + 1);
+		t = v[i];
+		v[i] = v[j];
+		v[j] = t;
+	}
+}
+
+/*
+ * Draw a Mallows order by repeated insertion: candidate i goes in at
+ * position j of the first i with weight phi^(i - j).
+ */
+static void
+mallows(int *v)
+{
+	int i, j;
+	double w, total, u;
+
+	for (i = 0; i < num_candidates; i++) {
+		total = 0;
+		for (j = i, w = 1; j >= 0; j--, w *= phi)
+			total += w;
+		u = rand_unit() * total;
+		for (j = i, w = 1; j > 0 && u >= w; j--, w *= phi)
+			u -= w;
+		memmove(v + j + 1, v + j, (i - j) * sizeof v[0]);
+		v[j] = i;
+	}
+}
+
+/*
+ * Voter group g ranks block g first, then the next, then the last.
+ * Each block is in a random order.
+ */
+static void
+cyclic(int *v, int g)
+{
+	int b, k, n, c, first, lo, hi;
+
+	n = 0;
+	for (k = 0; k < 3; k++) {
+		b = (g + k) % 3;
+		lo = (long long)num_candidates * b / 3;
+		hi = (long long)num_candidates * (b + 1) / 3;
+		first = n;
+		for (c = lo; c < hi; c++)
+			v[n++] = c;
+		shuffle(v + first, n - first);
+	}
+}
+
+/*
+ * Fill in v[] with voter i's ballot.  Returns the number ranked.
+ */
+static int
+ballot(int i, int *v)
+{
+	int c;
+
+	switch (model) {
+	case MODEL_MALLOWS:
+		mallows(v);
+		break;
+	case MODEL_CYCLIC:
+		cyclic(v, i % 3);
+		break;
+	default:
+		for (c = 0; c < num_candidates; c++)
+			v[c] = c;
+		shuffle(v, num_candidates);
+	}
+	if (truncate_at)
+		return 1 + rand_below(truncate_at);
+	return num_candidates;
+}
+
+static void
+write_lines()
+{
+	int i, c, n;
+	int *v;
+
+	v = calloc(num_candidates, sizeof v[0]);
+	if (!v) {
+		fprintf(stderr, "%s: out of memory\n", myname);
+		exit(1);
+	}
+	for (c = 0; c < num_candidates; c++)
+		printf("%sc%d", c ? "," : "", c + 1);
+	printf("\n");
+	for (i = 0; i < num_voters; i++) {
+		n = ballot(i, v);
+		for (c = 0; c < n; c++)
+			printf("%sc%d", c ? "," : "", v[c] + 1);
+		printf("\n");
+	}
+	free(v);
+}
+
+/*
+ * The column form has one column per voter, so the whole election
+ * is drawn first.  0 marks the end of a short ballot.
+ */
+static void
+write_columns()
+{
+	int i, c, n;
+	int *v;
+
+	v = calloc((size_t)num_voters * num_candidates, sizeof v[0]);
+	if (!v) {
+		fprintf(stderr, "%s: out of memory\n", myname);
+		exit(1);
+	}
+	for (i = 0; i < num_voters; i++) {
+		n = ballot(i, v + (size_t)i * num_candidates);
+		for (c = 0; c < num_candidates; c++)
+			v[(size_t)i * num_candidates + c] = c < n ?
+				v[(size_t)i * num_candidates + c] + 1 : 0;
+	}
+
+	printf("candidates");
+	for (i = 0; i < num_voters; i++)
+		printf(",v%d", i + 1);
+	printf("\n");
+	for (c = 0; c < num_candidates; c++) {
+		printf("c%d", c + 1);
+		for (i = 0; i < num_voters; i++)
+			if (v[(size_t)i * num_candidates + c])
+				printf(",c%d", v[(size_t)i * num_candidates + c]);
+			else
+				printf(",");
+		printf("\n");
+	}
+	free(v);
+}
+
+static void
+usage()
+{
+	fprintf(stderr, "Usage: %s [options] >output\n", myname);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-c N <number of candidates, default 10>\n");
+	fprintf(stderr, "\t-n N <number of voters, default 1000>\n");
+	fprintf(stderr, "\t-m model <ic, mallows or cyclic, default ic>\n");
+	fprintf(stderr, "\t-p phi <Mallows dispersion, 0 to 1, default 0.8>\n");
+	fprintf(stderr, "\t-t N <rank only the first 1 to N candidates>\n");
+	fprintf(stderr, "\t-s seed <random seed, default 1>\n");
+	fprintf(stderr, "\t-k <write the column form, not one ballot per line>\n");
+	fprintf(stderr, "\t-h <print this help>\n");
+	exit(1);
+}
+
+static void
+grok_args(int argc, char **argv)
+{
+	int c, i;
+	int errors;
+
+	myname = *argv;
+	num_candidates = 10;
+	num_voters = 1000;
+	phi = 0.8;
+	seed = 1;
+	errors = 0;
+
+	while ((c = getopt(argc, argv, "c:n:m:p:t:s:kh")) != EOF)
+		switch(c) {
+			case 'c':
+				num_candidates = atoi(optarg);
+				break;
+			case 'n':
+				num_voters = atoi(optarg);
+				break;
+			case 'm':
+				for (i = 0; i < 3; i++)
+					if (strcmp(optarg, model_names[i]) == 0)
+						break;
+				if (i == 3) {
+					fprintf(stderr, "%s: unknown model %s\n", myname, optarg);
+					errors++;
+				}
+				model = i;
+				break;
+			case 'p':
+				phi = atof(optarg);
+				break;
+			case 't':
+				truncate_at = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'k':
+				column_mode++;
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage();
+		}
+
+	if (num_candidates < 1) {
+		fprintf(stderr, "%s: need at least one candidate\n", myname);
+		errors++;
+	}
+	if (num_voters < 0) {
+		fprintf(stderr, "%s: the number of voters cannot be negative\n", myname);
+		errors++;
+	}
+	if (phi <= 0 || phi > 1) {
+		fprintf(stderr, "%s: phi must be more than 0 and at most 1\n", myname);
+		errors++;
+	}
+	if (truncate_at < 0 || truncate_at > num_candidates) {
+		fprintf(stderr, "%s: -t must be from 0 to the number of candidates\n", myname);
+		errors++;
+	}
+	if (optind < argc) {
+		fprintf(stderr, "%s: no positional arguments\n", myname);
+		errors++;
+	}
+	if (errors)
+		usage();
+}
+
+int
+main(int argc, char **argv)
+{
+	grok_args(argc, argv);
+	if (column_mode)
+		write_columns();
+	else
+		write_lines();
+	return 0;
+}
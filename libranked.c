@@ -0,0 +1,3829 @@
+/*
+ * libranked: the ranked pairs count, without the input handling.
+ * See ranked.h for how to call it.
+ *
+ * Every voter's ballot is counted into a pairwise matrix, or for a
+ * sparse tally a table of the pairs ranked together.  Each pair of
+ * candidates gives a majority, the margin by which one was preferred to
+ * the other.  Unranked candidates and Condorcet winners and losers are
+ * taken out first; the rest are ranked by locking the majorities in
+ * order of strength, skipping any that would close a cycle.
+ */
+
+/*
+
+
+NOTE: Tied rankings.  election_rank() produces a ranking,
+not all rankings.  Which ranking depends on the order the
+pairs were built in; see do_sort().  The others are only
+found on request; see find_outcomes().
+
+
+ */
+
+#include <stdio.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "ranked.h"
+
+static const char *ranking_source_names[] = {
+	"NULL",
+	"Condorcet Winner",
+	"Condorcet Loser",
+	"Ranked Pairs Winner",
+	"Ranked Pairs Loser",
+	"No Rankings",
+	"No Algorithm",
+};
+
+struct candidate_s {
+	char *name;
+	int ranking;
+	int ranking_phase;
+	int ranking_source;
+	int wins_pair;
+	int loses_pair;
+	int ties;
+};
+
+/*
+ * While tallying, an unranked candidate is given this rank,
+ * so it is below every ranked candidate.
+ */
+#define	UNRANKED	INT_MAX
+
+/*
+ * Distinct ballots waiting to be tallied, with the number of voters
+ * who cast each one.  Identical ballots are found through a hash table
+ * of ballot indices, -1 if empty, never more than half full.
+ * A ballot is a list of (candidate, rank) pairs, kept in ballot_pool.
+ * The table is tallied and emptied once it holds BALLOT_FLUSH ballots.
+ */
+#define	BALLOT_FLUSH	(1 << 16)
+struct ballot_s {
+	unsigned hash;
+	int n;		// number of candidates ranked
+	int weight;
+	int off;	// index of the first pair in ballot_pool
+};
+
+/*
+ * Majorities.
+ * Who ranks higher than who?  One for each possible pair.
+ */
+struct thread_tally_s {
+	int *pw;
+	int *mn;
+};
+
+struct majority_s {
+	int c1;		// winner, if strength > 0.  Most of the code is normalized so c1 wins.
+	int c2;		// winner, if strength < 0
+	int strength;
+	int locked;
+};
+
+/*
+ * A set of blobs of len bytes each, for merging lock graphs and
+ * rankings that come out the same.  slot[] is an open addressed hash
+ * table of pointers, never more than half full.  list[] has the same
+ * blobs in the order they were added.  The set owns them.
+ */
+struct blobset_s {
+	size_t len;
+	char **slot;
+	unsigned mask;
+	char **list;
+	int count;
+	int alloc;
+};
+
+struct election_s {
+	/*
+	 * Errors.  fail() leaves the message in error[] and jumps back to
+	 * the public call that was entered, which returns -1.
+	 */
+	char error[256];
+	jmp_buf env;
+	int failed;
+
+	FILE *log;
+	int verbose;
+	int debug;
+	int num_threads;
+	void (*stage_fn)(void *, const char *);
+	void *stage_arg;
+
+	int num_candidates;
+	int next_winner;
+	int next_loser;
+	struct candidate_s *candidates;
+	int candidates_alloc;
+
+	int ranked;
+	int ranking_phase;
+	int ranking_tie;
+	int ranking_tie_phase;
+
+	/*
+	 * Hash index of the candidate names, case folded.
+	 * Each slot holds a candidate index, or -1 if empty.
+	 * The table is a power of two in size and never more than half full.
+	 */
+	int *cand_hash;
+	unsigned cand_hash_mask;
+
+	/*
+	 * pairwise[i * num_candidates + j] counts the voters who ranked
+	 * candidate i higher than candidate j.  Ranking a candidate at all
+	 * counts as ranking them higher than every unranked candidate.
+	 * mentions[i] counts the voters who ranked candidate i at all.
+	 * Both are allocated by the first ballot, which fixes the candidates.
+	 */
+	int *pairwise;
+	int *mentions;
+	int num_voters;
+
+	/*
+	 * Threads past the first count into matrices of their own,
+	 * thread_tally[t] for thread t, across every flush of the ballot
+	 * table.  tally_ballots() adds them into pairwise[] and mentions[]
+	 * once, and frees them.  num_thread_tally of them are allocated.
+	 */
+	struct thread_tally_s *thread_tally;
+	int thread_tally_alloc;
+	int num_thread_tally;
+
+	/*
+	 * With sparse set there is no pairwise matrix, for elections with
+	 * many candidates and short ballots.  Only pairs ranked on the same
+	 * ballot are kept, in an open addressed hash table never more than
+	 * half full.  pair_key[] is a * num_candidates + b + 1 for a < b,
+	 * 0 if empty; pair_diff[] the voters who ranked a above b less
+	 * those who ranked b above a.  See margin() for the rest.
+	 */
+	int sparse;
+	uint64_t *pair_key;
+	int *pair_diff;
+	size_t pair_mask;
+	size_t num_pairs;
+	long long distinct;
+
+	// seen[c] == stamp if the ballot being added has candidate c.
+	unsigned *seen;
+	unsigned stamp;
+
+	struct ballot_s *ballots;
+	int num_ballots;
+	int ballots_alloc;
+	int *ballot_pool;
+	int pool_used;
+	int pool_alloc;
+	int *ballot_hash;
+	unsigned ballot_hash_mask;
+
+	/*
+	 * With keep set, each batch of distinct ballots is copied here
+	 * before it is emptied, for election_bootstrap().  The same ballot
+	 * may be kept once for each batch it came in.
+	 */
+	int keep;
+	struct ballot_s *kept;
+	int num_kept;
+	int kept_alloc;
+	int *kept_pool;
+	int kept_used;
+	int kept_pool_alloc;
+
+	int num_majorities;
+	struct majority_s *majorities;
+
+	/*
+	 * Candidates whose majorities are still in play.
+	 * Removing a candidate only clears its flag and adjusts num_majorities.
+	 * The dead entries stay in majorities[], which has majorities_len
+	 * entries, until live_majorities() squeezes them out.
+	 */
+	char *active;
+	int num_active;
+	int majorities_len;
+
+	/*
+	 * The locked graph, kept as reachability bitsets, num_words words a row.
+	 * Bit y of reach[x] is set if there is a path of locked arcs from x to y.
+	 * reached_by[] is the same thing backwards.
+	 * An arc goes from x to y if these exists i such that
+	 *  majorities[i].locked
+	 *  majorities[i].c1==x
+	 *  majorities[i].c2==y
+	 */
+	int num_words;
+	uint64_t *reach;
+	uint64_t *reached_by;
+	uint64_t *reach_scratch;	// two rows, for add_arc()
+
+	/*
+	 * Tied outcomes (election_set_outcomes).  See find_outcomes().
+	 * A lock graph is graph_words words: reach, then reached_by.
+	 * outcomes[] holds num_outcomes rankings of every candidate.
+	 */
+	int outcome_limit;	// kilobytes of lock graphs
+	long long outcome_max;	// lock graphs that fit in outcome_limit
+	long long outcome_graphs;	// lock graphs built so far
+	long long outcome_live;		// search graphs held by tie_block()
+	long long outcome_steps;	// steps of work so far
+	long long outcome_steps_max;
+	int outcomes_cut;	// stopped at outcome_max or outcome_steps_max
+	size_t graph_words;
+	uint64_t *block_scratch;	// one row, for could_block()
+	uint64_t *next_scratch;		// one graph
+	uint64_t *order_scratch;	// one graph, for schedule()
+	uint64_t **frontier;
+	int num_frontier;
+	struct blobset_s next;	// graphs at the end of the tie block
+	int num_outcomes;
+	int *outcomes;
+	int outcomes_alloc;
+
+	/*
+	 * Memory a call holds only while it runs, from temp_alloc().
+	 * fail() frees it, since the jump skips the call's own frees.
+	 */
+	void **temps;
+	int num_temps;
+	int temps_alloc;
+	int searching;		// reach is on the outcome search's graphs
+
+	struct election_counts_s counts;
+};
+
+/*
+ * Every public call that can fail starts with ENTER.
+ * setjmp() is the whole of an if, as the standard requires.
+ */
+#define	ENTER(e)	do {					\
+		if ((e)->failed)				\
+			return -1;				\
+		if (setjmp((e)->env))				\
+			return -1;				\
+	} while (0)
+
+static void
+fail(struct election_s *e, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(e->error, sizeof e->error, fmt, ap);
+	va_end(ap);
+	while (e->num_temps > 0)
+		free(e->temps[--e->num_temps]);
+	// the graphs reach was on belong to the search; see find_outcomes().
+	if (e->searching) {
+		e->reach = e->reached_by = NULL;
+		e->searching = 0;
+	}
+	e->failed = 1;
+	longjmp(e->env, 1);
+}
+
+/*
+ * Leave a message for a call that is refused, but which changed
+ * nothing, so the election can go on.  Returns -1 for it to return.
+ */
+static int
+reject(struct election_s *e, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(e->error, sizeof e->error, fmt, ap);
+	va_end(ap);
+	return -1;
+}
+
+/*
+ * Allocate zeroed memory for n elements of the given size.
+ */
+static void *
+zalloc(struct election_s *e, size_t n, size_t size)
+{
+	void *p;
+
+	p = calloc(n ? n : 1, size);
+	if (!p)
+		fail(e, "out of memory");
+	return p;
+}
+
+/*
+ * Make sure the array at p has room for at least n elements of the given size.
+ * *alloc is the number of elements currently allocated; it is updated.
+ * Returns the (possibly moved) array.
+ */
+static void *
+grow(struct election_s *e, void *p, int *alloc, int n, size_t size)
+{
+	int a;
+
+	if (n <= *alloc)
+		return p;
+	a = *alloc ? *alloc : 16;
+	while (a < n)
+		a *= 2;
+	p = realloc(p, (size_t)a * size);
+	if (!p)
+		fail(e, "out of memory");
+	memset((char *)p + (size_t)*alloc * size, 0, (size_t)(a - *alloc) * size);
+	*alloc = a;
+	return p;
+}
+
+/*
+ * Allocate zeroed memory that is freed by temp_free(), or by fail().
+ */
+static void *
+temp_alloc(struct election_s *e, size_t n, size_t size)
+{
+	e->temps = grow(e, e->temps, &e->temps_alloc, e->num_temps + 1,
+		sizeof e->temps[0]);
+	e->temps[e->num_temps] = zalloc(e, n, size);
+	return e->temps[e->num_temps++];
+}
+
+static void
+temp_free(struct election_s *e, void *p)
+{
+	int i;
+
+	// usually the last one allocated.
+	for (i = e->num_temps - 1; i >= 0 && e->temps[i] != p; i--)
+		;
+	if (i >= 0) {
+		memmove(e->temps + i, e->temps + i + 1,
+			(e->num_temps - i - 1) * sizeof e->temps[0]);
+		e->num_temps--;
+	}
+	free(p);
+}
+
+static void blob_clear(struct blobset_s *sp);
+static void free_frontier(struct election_s *e);
+
+static void
+stage(struct election_s *e, const char *name)
+{
+	if (e->stage_fn)
+		e->stage_fn(e->stage_arg, name);
+}
+
+struct election_s *
+election_new()
+{
+	struct election_s *e;
+
+	e = calloc(1, sizeof *e);
+	if (!e)
+		return NULL;
+	e->log = stdout;
+	e->num_threads = 1;
+	return e;
+}
+
+/*
+ * Free the matrices the threads past the first count into.
+ */
+static void
+free_thread_tally(struct election_s *e)
+{
+	int t;
+
+	for (t = 1; t < e->num_thread_tally; t++) {
+		free(e->thread_tally[t].pw);
+		free(e->thread_tally[t].mn);
+	}
+	free(e->thread_tally);
+	e->thread_tally = NULL;
+	e->thread_tally_alloc = e->num_thread_tally = 0;
+}
+
+void
+election_free(struct election_s *e)
+{
+	int i;
+
+	if (!e)
+		return;
+	for (i = 0; i < e->num_candidates; i++)
+		free(e->candidates[i].name);
+	free(e->candidates);
+	free(e->cand_hash);
+	free(e->pairwise);
+	free_thread_tally(e);
+	free(e->pair_key);
+	free(e->pair_diff);
+	free(e->mentions);
+	free(e->seen);
+	free(e->ballots);
+	free(e->ballot_pool);
+	free(e->ballot_hash);
+	free(e->kept);
+	free(e->kept_pool);
+	free(e->majorities);
+	free(e->active);
+	free(e->reach);
+	free(e->reached_by);
+	free(e->reach_scratch);
+	free(e->block_scratch);
+	free(e->next_scratch);
+	free(e->order_scratch);
+	free_frontier(e);
+	blob_clear(&e->next);
+	free(e->outcomes);
+	free(e->temps);
+	free(e);
+}
+
+const char *
+election_error(struct election_s *e)
+{
+	return e->error;
+}
+
+void
+election_set_threads(struct election_s *e, int n)
+{
+	e->num_threads = n < 1 ? 1 : n;
+}
+
+void
+election_set_log(struct election_s *e, FILE *fp, int verbose, int debug)
+{
+	e->log = fp;
+	e->verbose = verbose;
+	e->debug = debug;
+}
+
+void
+election_set_stage_hook(struct election_s *e,
+	void (*fn)(void *arg, const char *name), void *arg)
+{
+	e->stage_fn = fn;
+	e->stage_arg = arg;
+}
+
+void
+election_counts(struct election_s *e, struct election_counts_s *cp)
+{
+	*cp = e->counts;
+}
+
+/*
+ * Hash a candidate name, ignoring case.
+ */
+static unsigned
+name_hash(const char *p, int len)
+{
+	unsigned h;
+
+	h = 2166136261u;
+	while (len-- > 0)
+		h = (h ^ tolower((unsigned char)*p++)) * 16777619u;
+	return h;
+}
+
+/*
+ * Put candidate i in the hash index, unless the name is already there.
+ */
+static void
+index_candidate(struct election_s *e, int i)
+{
+	unsigned h;
+	char *name = e->candidates[i].name;
+
+	for (h = name_hash(name, strlen(name)) & e->cand_hash_mask;
+	     e->cand_hash[h] >= 0;
+	     h = (h + 1) & e->cand_hash_mask) {
+		e->counts.name_compares++;
+		if (strcasecmp(e->candidates[e->cand_hash[h]].name, name) == 0)
+			return;
+	}
+	e->cand_hash[h] = i;
+}
+
+/*
+ * Build the hash index over all the candidates, big enough for them.
+ * If a name appears twice, lookups find the first one.
+ */
+static void
+index_candidates(struct election_s *e)
+{
+	int i;
+	unsigned size;
+
+	for (size = 16; size < 2 * (unsigned)e->num_candidates; size *= 2)
+		;
+	free(e->cand_hash);
+	e->cand_hash = zalloc(e, size, sizeof e->cand_hash[0]);
+	memset(e->cand_hash, -1, size * sizeof e->cand_hash[0]);
+	e->cand_hash_mask = size - 1;
+	for (i = 0; i < e->num_candidates; i++)
+		index_candidate(e, i);
+}
+
+static int
+find_candidate(struct election_s *e, const char *p, int len)
+{
+	unsigned h;
+	char *name;
+
+	if (!e->cand_hash)
+		return -1;
+	for (h = name_hash(p, len) & e->cand_hash_mask;
+	     e->cand_hash[h] >= 0;
+	     h = (h + 1) & e->cand_hash_mask) {
+		name = e->candidates[e->cand_hash[h]].name;
+		e->counts.name_compares++;
+		if (strncasecmp(name, p, len) == 0 && !name[len])
+			return e->cand_hash[h];
+	}
+	return -1;
+}
+
+static int
+new_candidate(struct election_s *e, const char *name, int len)
+{
+	int c;
+
+	if (e->mentions)
+		fail(e, "candidates must all be added before the first ballot");
+	if (len < 1)
+		fail(e, "found a blank candidate.");
+	c = e->num_candidates;
+	e->candidates = grow(e, e->candidates, &e->candidates_alloc, c + 1,
+		sizeof e->candidates[0]);
+	e->candidates[c].name = zalloc(e, len + 1, 1);
+	memcpy(e->candidates[c].name, name, len);
+	e->num_candidates++;
+	if (!e->cand_hash || 2 * (unsigned)e->num_candidates > e->cand_hash_mask + 1)
+		index_candidates(e);
+	else
+		index_candidate(e, c);
+	return c;
+}
+
+int
+election_add_candidate(struct election_s *e, const char *name, int len)
+{
+	ENTER(e);
+	if (e->mentions)
+		return reject(e, "candidates must all be added before the first ballot");
+	if (len < 1)
+		return reject(e, "found a blank candidate.");
+	return new_candidate(e, name, len);
+}
+
+/*
+ * Return the number of the candidate with this name, or -1 if there is none.
+ */
+int
+election_find_candidate(struct election_s *e, const char *name, int len)
+{
+	return find_candidate(e, name, len);
+}
+
+int
+election_num_candidates(struct election_s *e)
+{
+	return e->num_candidates;
+}
+
+const char *
+election_candidate_name(struct election_s *e, int c)
+{
+	if (c < 0 || c >= e->num_candidates)
+		return NULL;
+	return e->candidates[c].name;
+}
+
+/*
+ * Empty the distinct ballot table.
+ */
+static void
+clear_ballots(struct election_s *e)
+{
+	unsigned size;
+
+	e->num_ballots = 0;
+	e->pool_used = 0;
+	if (!e->ballot_hash) {
+		size = 2 * BALLOT_FLUSH;
+		e->ballot_hash = zalloc(e, size, sizeof e->ballot_hash[0]);
+		e->ballot_hash_mask = size - 1;
+	}
+	memset(e->ballot_hash, -1, (e->ballot_hash_mask + 1) * sizeof e->ballot_hash[0]);
+}
+
+/*
+ * The candidates are settled; allocate the pairwise matrix and mention
+ * counts, all zeroes, and the ballot table.  A sparse tally starts with
+ * an empty pair table instead of the matrix.
+ */
+static void
+start_tally(struct election_s *e)
+{
+	size_t n = e->num_candidates;
+
+	if (e->mentions)
+		return;
+	if (e->sparse) {
+		e->pair_key = zalloc(e, 1024, sizeof e->pair_key[0]);
+		e->pair_diff = zalloc(e, 1024, sizeof e->pair_diff[0]);
+		e->pair_mask = 1023;
+	} else
+		e->pairwise = zalloc(e, n * n, sizeof e->pairwise[0]);
+	e->mentions = zalloc(e, n, sizeof e->mentions[0]);
+	e->seen = zalloc(e, n, sizeof e->seen[0]);
+	clear_ballots(e);
+}
+
+/*
+ * row[b] += w for every b with r < rank[b].
+ * This is the inner loop of the whole tally, so it is vectorized.
+ */
+static void
+accumulate_row(int *row, const int *rank, int r, int w, int n)
+{
+	int b;
+
+	b = 0;
+#if defined(__AVX2__)
+	{
+		__m256i vr = _mm256_set1_epi32(r);
+		__m256i vw = _mm256_set1_epi32(w);
+		__m256i m;
+
+		// the compare gives all ones where rank[b] > r.
+		for (; b + 8 <= n; b += 8) {
+			m = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)(rank + b)), vr);
+			_mm256_storeu_si256((__m256i *)(row + b),
+				_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(row + b)),
+					_mm256_and_si256(m, vw)));
+		}
+	}
+#elif defined(__SSE2__)
+	{
+		__m128i vr = _mm_set1_epi32(r);
+		__m128i vw = _mm_set1_epi32(w);
+		__m128i m;
+
+		for (; b + 4 <= n; b += 4) {
+			m = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(rank + b)), vr);
+			_mm_storeu_si128((__m128i *)(row + b),
+				_mm_add_epi32(_mm_loadu_si128((const __m128i *)(row + b)),
+					_mm_and_si128(m, vw)));
+		}
+	}
+#endif
+	for (; b < n; b++)
+		if (r < rank[b])
+			row[b] += w;
+}
+
+/*
+ * Add one ballot, cast by w voters, to a pairwise tally of nc candidates.
+ * rank[c] is the rank the voter gave candidate c, or UNRANKED.
+ * list[] holds the n candidates the voter did rank.
+ * Each ranked candidate beats everyone the voter ranked lower, or not at all.
+ */
+static void
+tally_ballot(int *pw, int *mn, int *rank, int *list, int n, int w, int nc)
+{
+	int i, a;
+
+	for (i = 0; i < n; i++) {
+		a = list[i];
+		mn[a] += w;
+		accumulate_row(pw + (size_t)a * nc, rank, rank[a], w, nc);
+	}
+}
+
+/*
+ * Double the size of the ballot hash table.
+ */
+static void
+rehash_ballots(struct election_s *e)
+{
+	int i;
+	unsigned size, h;
+
+	size = 2 * (e->ballot_hash_mask + 1);
+	free(e->ballot_hash);
+	e->ballot_hash = NULL;
+	e->ballot_hash = zalloc(e, size, sizeof e->ballot_hash[0]);
+	memset(e->ballot_hash, -1, size * sizeof e->ballot_hash[0]);
+	e->ballot_hash_mask = size - 1;
+	for (i = 0; i < e->num_ballots; i++) {
+		for (h = e->ballots[i].hash & e->ballot_hash_mask;
+		     e->ballot_hash[h] >= 0;
+		     h = (h + 1) & e->ballot_hash_mask)
+			;
+		e->ballot_hash[h] = i;
+	}
+}
+
+/*
+ * Record a ballot cast by w voters.
+ * pairs[] holds n (candidate, rank) pairs.
+ * If the same ballot is already in the table, just add to its weight.
+ */
+static void
+add_ballot(struct election_s *e, const int *pairs, int n, int w)
+{
+	int i;
+	unsigned h;
+	struct ballot_s *bp;
+
+	h = 2166136261u;
+	for (i = 0; i < 2 * n; i++)
+		h = (h ^ (unsigned)pairs[i]) * 16777619u;
+
+	for (i = h & e->ballot_hash_mask;
+	     e->ballot_hash[i] >= 0;
+	     i = (i + 1) & e->ballot_hash_mask) {
+		bp = &e->ballots[e->ballot_hash[i]];
+		if (bp->hash == h && bp->n == n &&
+		    memcmp(e->ballot_pool + bp->off, pairs, 2 * n * sizeof pairs[0]) == 0) {
+			bp->weight += w;
+			return;
+		}
+	}
+
+	e->ballots = grow(e, e->ballots, &e->ballots_alloc, e->num_ballots + 1,
+		sizeof e->ballots[0]);
+	e->ballot_pool = grow(e, e->ballot_pool, &e->pool_alloc, e->pool_used + 2 * n,
+		sizeof e->ballot_pool[0]);
+	bp = &e->ballots[e->num_ballots];
+	bp->hash = h;
+	bp->n = n;
+	bp->weight = w;
+	bp->off = e->pool_used;
+	memcpy(e->ballot_pool + e->pool_used, pairs, 2 * n * sizeof pairs[0]);
+	e->pool_used += 2 * n;
+	e->ballot_hash[i] = e->num_ballots++;
+	if (2 * (unsigned)e->num_ballots > e->ballot_hash_mask)
+		rehash_ballots(e);
+}
+
+/*
+ * One tally thread.  Counts ballots [first, last) into its own
+ * pairwise matrix and mention counts.  The threads cannot fail(),
+ * so one that runs out of memory sets failed instead.
+ */
+struct tally_s {
+	struct election_s *e;
+	pthread_t tid;
+	int thread;	// tid is a thread to join
+	int failed;
+	int first;
+	int last;
+	int *pw;
+	int *mn;
+};
+
+#if !defined(__AVX2__) && !defined(__SSE2__)
+/*
+ * Transpose a 64x64 bit matrix in place:
+ * afterwards bit j of a[i] is what bit i of a[j] was.
+ */
+static void
+transpose64(uint64_t *a)
+{
+	int j, k;
+	uint64_t m, t;
+
+	for (j = 32, m = 0x00000000FFFFFFFFULL; j; j >>= 1, m ^= m << j)
+		for (k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+			t = ((a[k] >> j) ^ a[k | j]) & m;
+			a[k] ^= t << j;
+			a[k | j] ^= t;
+		}
+}
+
+/*
+ * The bit tally, used when there are no more than 64 candidates and
+ * accumulate_row has no vector instructions to work with.  Where it
+ * does, its rows are quicker than this, so this is left out.
+ * Each ballot is reduced to one word per ranked candidate a, the set
+ * of candidates a beats on that ballot.  Rather than adding that word
+ * into a row of counters one bit at a time, it is added into a stack
+ * of BIT_PLANES words that hold a's row bit sliced: bit b of word k is
+ * bit k of the count for (a, b).  An add is a carry chain of ANDs and
+ * XORs that covers all the candidates at once.  The planes are small,
+ * so they are moved out to pairwise before they can overflow.
+ */
+#define	BIT_PLANES	8
+#define	BIT_MAX		((1 << BIT_PLANES) - 1)
+
+struct bits_s {
+	int n;			// number of candidates
+	uint64_t *plane;	// [candidate][BIT_PLANES]
+	int *count;		// [candidate], total weight in the planes
+	int *pw;
+};
+
+/*
+ * Add candidate a's planes into its pairwise row, and clear them.
+ * Transposing the planes leaves the count for (a, b) in word b.
+ */
+static void
+flush_bits(struct bits_s *bp, int a)
+{
+	int b;
+	uint64_t t[64];
+	uint64_t *plane = bp->plane + (size_t)a * BIT_PLANES;
+	int *row = bp->pw + (size_t)a * bp->n;
+
+	memcpy(t, plane, BIT_PLANES * sizeof t[0]);
+	memset(t + BIT_PLANES, 0, (64 - BIT_PLANES) * sizeof t[0]);
+	transpose64(t);
+	for (b = 0; b < bp->n; b++)
+		row[b] += t[b];
+	memset(plane, 0, BIT_PLANES * sizeof plane[0]);
+	bp->count[a] = 0;
+}
+
+/*
+ * Add w to the count for (a, b) for every b in beats.
+ */
+static void
+add_bits(struct bits_s *bp, int a, uint64_t beats, int w)
+{
+	int j, k, b;
+	uint64_t carry, t;
+	uint64_t *plane;
+
+	// too heavy for the planes; add it straight in.
+	if (w > BIT_MAX) {
+		for (; beats; beats &= beats - 1) {
+			b = __builtin_ctzll(beats);
+			bp->pw[(size_t)a * bp->n + b] += w;
+		}
+		return;
+	}
+	if (bp->count[a] + w > BIT_MAX)
+		flush_bits(bp, a);
+	bp->count[a] += w;
+	plane = bp->plane + (size_t)a * BIT_PLANES;
+	for (k = 0; w; k++, w >>= 1) {
+		if (!(w & 1))
+			continue;
+		carry = beats;
+		for (j = k; j < BIT_PLANES; j++) {
+			t = plane[j] & carry;
+			plane[j] ^= carry;
+			carry = t;
+		}
+	}
+}
+
+static void
+tally_range_bits(struct tally_s *tp)
+{
+	int i, j, k, n, a, r, w;
+	int *pairs;
+	int *order;
+	uint64_t all, above, group;
+	struct bits_s bits;
+	struct election_s *e = tp->e;
+	int nc = e->num_candidates;
+
+	bits.n = nc;
+	bits.plane = calloc((size_t)nc * BIT_PLANES + 1, sizeof bits.plane[0]);
+	bits.count = calloc(nc + 1, sizeof bits.count[0]);
+	bits.pw = tp->pw;
+	order = calloc(2 * nc + 1, sizeof order[0]);
+	if (!bits.plane || !bits.count || !order) {
+		tp->failed = 1;
+		goto out;
+	}
+	all = nc == 64 ? ~(uint64_t)0 : ((uint64_t)1 << nc) - 1;
+
+	for (i = tp->first; i < tp->last; i++) {
+		n = e->ballots[i].n;
+		w = e->ballots[i].weight;
+		pairs = e->ballot_pool + e->ballots[i].off;
+
+		// order the (candidate, rank) pairs best rank first.
+		for (j = 0; j < n; j++) {
+			a = pairs[2 * j];
+			r = pairs[2 * j + 1];
+			for (k = j; k > 0 && order[2 * k - 1] > r; k--) {
+				order[2 * k] = order[2 * k - 2];
+				order[2 * k + 1] = order[2 * k - 1];
+			}
+			order[2 * k] = a;
+			order[2 * k + 1] = r;
+		}
+
+		// each group of equal rank beats everyone not yet seen.
+		above = 0;
+		for (j = 0; j < n; j = k) {
+			group = 0;
+			for (k = j; k < n && order[2 * k + 1] == order[2 * j + 1]; k++)
+				group |= (uint64_t)1 << order[2 * k];
+			above |= group;
+			for (k = j; k < n && order[2 * k + 1] == order[2 * j + 1]; k++) {
+				a = order[2 * k];
+				tp->mn[a] += w;
+				add_bits(&bits, a, all & ~above, w);
+			}
+		}
+	}
+	for (a = 0; a < nc; a++)
+		flush_bits(&bits, a);
+
+out:
+	free(bits.plane);
+	free(bits.count);
+	free(order);
+}
+#endif
+
+static void *
+tally_range(void *arg)
+{
+	struct tally_s *tp = arg;
+	struct election_s *e = tp->e;
+	int nc = e->num_candidates;
+	int i, j, n;
+	int *rank;
+	int *list;
+	int *pairs;
+
+#if !defined(__AVX2__) && !defined(__SSE2__)
+	if (nc <= 64) {
+		tally_range_bits(tp);
+		return NULL;
+	}
+#endif
+	rank = calloc(nc + 1, sizeof rank[0]);
+	list = calloc(nc + 1, sizeof list[0]);
+	if (!rank || !list) {
+		tp->failed = 1;
+		free(rank);
+		free(list);
+		return NULL;
+	}
+	for (i = 0; i < nc; i++)
+		rank[i] = UNRANKED;
+	for (i = tp->first; i < tp->last; i++) {
+		n = e->ballots[i].n;
+		pairs = e->ballot_pool + e->ballots[i].off;
+		for (j = 0; j < n; j++) {
+			list[j] = pairs[2 * j];
+			rank[list[j]] = pairs[2 * j + 1];
+		}
+		tally_ballot(tp->pw, tp->mn, rank, list, n, e->ballots[i].weight, nc);
+		for (j = 0; j < n; j++)
+			rank[list[j]] = UNRANKED;
+	}
+	free(rank);
+	free(list);
+	return NULL;
+}
+
+/*
+ * Copy the distinct ballots to the kept ones.
+ */
+static void
+keep_ballots(struct election_s *e)
+{
+	int i, n;
+	struct ballot_s *bp;
+
+	for (i = 0; i < e->num_ballots; i++) {
+		bp = &e->ballots[i];
+		n = 2 * bp->n;
+		e->kept = grow(e, e->kept, &e->kept_alloc, e->num_kept + 1,
+			sizeof e->kept[0]);
+		e->kept_pool = grow(e, e->kept_pool, &e->kept_pool_alloc,
+			e->kept_used + n, sizeof e->kept_pool[0]);
+		memcpy(e->kept_pool + e->kept_used, e->ballot_pool + bp->off,
+			n * sizeof e->kept_pool[0]);
+		e->kept[e->num_kept] = *bp;
+		e->kept[e->num_kept].off = e->kept_used;
+		e->kept_used += n;
+		e->num_kept++;
+	}
+}
+
+/*
+ * The slot in the pair table for key, or the empty slot where it goes.
+ */
+static size_t
+pair_slot(struct election_s *e, uint64_t key)
+{
+	size_t h;
+
+	h = key * 0x9e3779b97f4a7c15ULL;
+	for (h = (h ^ h >> 29) & e->pair_mask;
+	     e->pair_key[h] && e->pair_key[h] != key;
+	     h = (h + 1) & e->pair_mask)
+		;
+	return h;
+}
+
+/*
+ * Double the size of the pair table.
+ */
+static void
+rehash_pairs(struct election_s *e)
+{
+	size_t i, h, size;
+	uint64_t *key = e->pair_key;
+	int *diff = e->pair_diff;
+
+	size = 2 * (e->pair_mask + 1);
+	e->pair_key = NULL;
+	e->pair_diff = NULL;
+	e->pair_key = calloc(size, sizeof e->pair_key[0]);
+	e->pair_diff = calloc(size, sizeof e->pair_diff[0]);
+	if (!e->pair_key || !e->pair_diff) {
+		free(key);
+		free(diff);
+		fail(e, "out of memory");
+	}
+	e->pair_mask = size - 1;
+	for (i = 0; i < size / 2; i++)
+		if (key[i]) {
+			h = pair_slot(e, key[i]);
+			e->pair_key[h] = key[i];
+			e->pair_diff[h] = diff[i];
+		}
+	free(key);
+	free(diff);
+}
+
+/*
+ * w more voters ranked a above b.
+ */
+static void
+add_pair(struct election_s *e, int a, int b, int w)
+{
+	size_t h;
+	uint64_t key;
+
+	if (a > b) {
+		key = (uint64_t)b * e->num_candidates + a + 1;
+		w = -w;
+	} else
+		key = (uint64_t)a * e->num_candidates + b + 1;
+	h = pair_slot(e, key);
+	if (!e->pair_key[h]) {
+		e->pair_key[h] = key;
+		if (2 * ++e->num_pairs > e->pair_mask)
+			rehash_pairs(e);
+		h = pair_slot(e, key);
+	}
+	e->pair_diff[h] += w;
+}
+
+/*
+ * The voters who ranked a above b less those who ranked b above a,
+ * among those who ranked both.
+ */
+static int
+pair_diff(struct election_s *e, int a, int b)
+{
+	size_t h;
+
+	if (a > b)
+		return -pair_diff(e, b, a);
+	h = pair_slot(e, (uint64_t)a * e->num_candidates + b + 1);
+	return e->pair_diff[h];
+}
+
+/*
+ * The sparse tally.  Each ballot adds its weight to the mentions of
+ * the candidates it ranks and to the pairs it ranks them in; a pair it
+ * ranks equal adds nothing, and so is not kept.  The pairs are few, so
+ * this is done on one thread.
+ */
+static void
+tally_sparse(struct election_s *e)
+{
+	int i, j, k, n, w;
+	int *pairs;
+
+	for (i = 0; i < e->num_ballots; i++) {
+		n = e->ballots[i].n;
+		w = e->ballots[i].weight;
+		pairs = e->ballot_pool + e->ballots[i].off;
+		for (j = 0; j < n; j++) {
+			e->mentions[pairs[2 * j]] += w;
+			for (k = j + 1; k < n; k++)
+				if (pairs[2 * j + 1] < pairs[2 * k + 1])
+					add_pair(e, pairs[2 * j], pairs[2 * k], w);
+				else if (pairs[2 * j + 1] > pairs[2 * k + 1])
+					add_pair(e, pairs[2 * k], pairs[2 * j], w);
+		}
+	}
+}
+
+/*
+ * Tally the distinct ballots, then empty the table.
+ * The ballots are split across num_threads threads.  The first counts
+ * straight into the real matrix, and each of the others into its own,
+ * which is kept for the next flush.  A thread that cannot be started
+ * is run in place.
+ */
+static void
+flush_ballots(struct election_s *e)
+{
+	int t, nt;
+	int failed;
+	size_t size;
+	struct tally_s *tally;
+	struct thread_tally_s *tt;
+
+	if (e->sparse) {
+		tally_sparse(e);
+		e->distinct += e->num_ballots;
+		clear_ballots(e);
+		return;
+	}
+	nt = e->num_threads;
+	if (nt > e->num_ballots)
+		nt = e->num_ballots;
+	if (nt < 1)
+		nt = 1;
+	size = (size_t)e->num_candidates * e->num_candidates;
+	e->thread_tally = grow(e, e->thread_tally, &e->thread_tally_alloc, nt,
+		sizeof e->thread_tally[0]);
+	while (e->num_thread_tally < nt) {
+		tt = &e->thread_tally[e->num_thread_tally++];
+		if (tt == e->thread_tally)
+			continue;
+		tt->pw = zalloc(e, size, sizeof tt->pw[0]);
+		tt->mn = zalloc(e, e->num_candidates, sizeof tt->mn[0]);
+	}
+	tally = temp_alloc(e, nt, sizeof tally[0]);
+
+	for (t = 0; t < nt; t++) {
+		tally[t].e = e;
+		tally[t].first = (long long)e->num_ballots * t / nt;
+		tally[t].last = (long long)e->num_ballots * (t + 1) / nt;
+		if (t == 0) {
+			tally[t].pw = e->pairwise;
+			tally[t].mn = e->mentions;
+			continue;
+		}
+		tally[t].pw = e->thread_tally[t].pw;
+		tally[t].mn = e->thread_tally[t].mn;
+		if (pthread_create(&tally[t].tid, NULL, tally_range, &tally[t]) == 0)
+			tally[t].thread = 1;
+		else
+			tally_range(&tally[t]);
+	}
+	tally_range(&tally[0]);
+
+	failed = tally[0].failed;
+	for (t = 1; t < nt; t++) {
+		if (tally[t].thread)
+			pthread_join(tally[t].tid, NULL);
+		failed |= tally[t].failed;
+	}
+	temp_free(e, tally);
+	if (failed)
+		fail(e, "out of memory");
+	e->distinct += e->num_ballots;
+	if (e->keep)
+		keep_ballots(e);
+	clear_ballots(e);
+}
+
+/*
+ * Count the ballots still in the table, and add in what the other
+ * threads have counted.  The counts are integers, so the result does
+ * not depend on the split.
+ */
+static void
+tally_ballots(struct election_s *e)
+{
+	int t;
+	size_t i, size;
+	struct thread_tally_s *tt;
+
+	flush_ballots(e);
+	size = (size_t)e->num_candidates * e->num_candidates;
+	for (t = 1; t < e->num_thread_tally; t++) {
+		tt = &e->thread_tally[t];
+		for (i = 0; i < size; i++)
+			e->pairwise[i] += tt->pw[i];
+		for (i = 0; i < (size_t)e->num_candidates; i++)
+			e->mentions[i] += tt->mn[i];
+	}
+	free_thread_tally(e);
+}
+
+int
+election_add_ballot(struct election_s *e, const int *pairs, int n, int weight)
+{
+	int i, c, r;
+
+	ENTER(e);
+	if (e->ranked)
+		return reject(e, "the election has already been ranked");
+	if (weight < 1)
+		return reject(e, "bad ballot count (%d)", weight);
+	// every count is at most num_voters, so that is the one to check.
+	if (weight > INT_MAX - e->num_voters)
+		return reject(e, "more than %d voters", INT_MAX);
+	if (n < 0 || n > e->num_candidates)
+		return reject(e, "a ballot ranks %d of %d candidates", n, e->num_candidates);
+	start_tally(e);
+	if (++e->stamp == 0) {
+		memset(e->seen, 0, e->num_candidates * sizeof e->seen[0]);
+		e->stamp = 1;
+	}
+	// a bad ballot is left out, and the election goes on.
+	for (i = 0; i < n; i++) {
+		c = pairs[2 * i];
+		r = pairs[2 * i + 1];
+		if (c < 0 || c >= e->num_candidates)
+			return reject(e, "a ballot ranks unknown candidate %d", c);
+		if (r < 1 || r == UNRANKED)
+			return reject(e, "a ballot gives candidate %s rank %d",
+				e->candidates[c].name, r);
+		if (e->seen[c] == e->stamp)
+			return reject(e, "a ballot ranks candidate %s more than once",
+				e->candidates[c].name);
+		e->seen[c] = e->stamp;
+	}
+	add_ballot(e, pairs, n, weight);
+	e->num_voters += weight;
+	if (e->num_ballots >= BALLOT_FLUSH)
+		flush_ballots(e);
+	return 0;
+}
+
+/*
+ * Count the ballots still in the table.
+ */
+int
+election_tally(struct election_s *e)
+{
+	ENTER(e);
+	start_tally(e);
+	tally_ballots(e);
+	return 0;
+}
+
+/*
+ * Keep the ballots after they are counted, for election_bootstrap().
+ */
+int
+election_keep_ballots(struct election_s *e)
+{
+	ENTER(e);
+	if (e->distinct)
+		return reject(e, "ballots have already been counted");
+	if (e->sparse)
+		return reject(e, "a bootstrap needs the pairwise matrix, not a sparse tally");
+	e->keep = 1;
+	return 0;
+}
+
+/*
+ * Tally only the pairs ranked on the same ballot.
+ */
+int
+election_set_sparse(struct election_s *e)
+{
+	ENTER(e);
+	if (e->mentions)
+		return reject(e, "the tally has already been started");
+	if (e->keep)
+		return reject(e, "a bootstrap needs the pairwise matrix, not a sparse tally");
+	e->sparse = 1;
+	return 0;
+}
+
+/*
+ * The number of voters: the ballots added, each counted as many times
+ * as its weight.
+ */
+int
+election_num_voters(struct election_s *e)
+{
+	return e->num_voters;
+}
+
+/*
+ * The number of distinct ballots counted.  A ballot that came again
+ * after its batch was counted is counted again.
+ */
+long long
+election_distinct_ballots(struct election_s *e)
+{
+	return e->distinct;
+}
+
+/*
+ * Partial tallies.
+ * The pairwise counts are written out instead of being ranked, so that
+ * precincts can be counted on different machines, and read back in and
+ * added up later.
+ *
+ * The file is the magic string, then as 32 bit ints in the byte order
+ * of the machine that wrote it: the number of candidates, the number
+ * of voters, each candidate name as a length followed by its bytes,
+ * the pairwise matrix by rows, and the mention counts.
+ */
+#define	PARTIAL_MAGIC	"RNKPART1"
+
+static void
+put_ints(struct election_s *e, FILE *fp, const char *name, const int32_t *v, size_t n)
+{
+	if (fwrite(v, sizeof v[0], n, fp) != n)
+		fail(e, "cannot write %s", name);
+}
+
+static void
+get_ints(struct election_s *e, FILE *fp, const char *name, int32_t *v, size_t n)
+{
+	if (fread(v, sizeof v[0], n, fp) != n)
+		fail(e, "%s is truncated", name);
+}
+
+int
+election_write_tally(struct election_s *e, FILE *fp, const char *name)
+{
+	int i;
+	int32_t h[2];
+
+	ENTER(e);
+	if (e->sparse)
+		return reject(e, "a partial tally needs the pairwise matrix, not a sparse tally");
+	start_tally(e);
+	tally_ballots(e);
+	fwrite(PARTIAL_MAGIC, 1, 8, fp);
+	h[0] = e->num_candidates;
+	h[1] = e->num_voters;
+	put_ints(e, fp, name, h, 2);
+	for (i = 0; i < e->num_candidates; i++) {
+		h[0] = strlen(e->candidates[i].name);
+		put_ints(e, fp, name, h, 1);
+		fwrite(e->candidates[i].name, 1, h[0], fp);
+	}
+	put_ints(e, fp, name, e->pairwise,
+		(size_t)e->num_candidates * e->num_candidates);
+	put_ints(e, fp, name, e->mentions, e->num_candidates);
+	if (fflush(fp) || ferror(fp))
+		fail(e, "cannot write %s", name);
+	return 0;
+}
+
+/*
+ * Add one partial tally into the pairwise matrix.
+ * If there are no candidates yet, the file's become the candidates.
+ * Otherwise it must have the same ones, in any order; they are
+ * matched by name.
+ */
+int
+election_merge_tally(struct election_s *e, FILE *fp, const char *name)
+{
+	int i, j, n;
+	int first, voters;
+	int32_t h[2];
+	char magic[8];
+	int *map;
+	char *seen;
+	char *s;
+	int32_t *pw;
+
+	ENTER(e);
+	if (e->ranked)
+		return reject(e, "the election has already been ranked");
+	if (e->keep)
+		return reject(e, "a bootstrap needs the ballots, not partial tallies");
+	if (e->sparse)
+		return reject(e, "a partial tally needs the pairwise matrix, not a sparse tally");
+	if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, PARTIAL_MAGIC, 8))
+		fail(e, "%s is not a partial tally", name);
+	get_ints(e, fp, name, h, 2);
+	n = h[0];
+	first = !e->num_candidates;
+	if (n < 1 || (!first && n != e->num_candidates))
+		fail(e, "%s has %d candidates, not %d", name, n, e->num_candidates);
+	if (h[1] < 0)
+		fail(e, "%s has %d voters", name, h[1]);
+	// every count is at most num_voters, so that is the one to check.
+	if (h[1] > INT_MAX - e->num_voters)
+		fail(e, "%s takes the count past %d voters", name, INT_MAX);
+	voters = h[1];
+
+	map = temp_alloc(e, n, sizeof map[0]);
+	seen = temp_alloc(e, n, sizeof seen[0]);
+	for (i = 0; i < n; i++) {
+		get_ints(e, fp, name, h, 1);
+		if (h[0] < 1)
+			fail(e, "%s has a bad candidate name", name);
+		s = temp_alloc(e, (size_t)h[0] + 1, 1);
+		if (fread(s, 1, h[0], fp) != (size_t)h[0])
+			fail(e, "%s is truncated", name);
+		if (first) {
+			map[i] = new_candidate(e, s, h[0]);
+			temp_free(e, s);
+			continue;
+		}
+		map[i] = find_candidate(e, s, h[0]);
+		if (map[i] < 0)
+			fail(e, "%s has unknown candidate %s", name, s);
+		if (seen[map[i]]++)
+			fail(e, "%s lists candidate %s more than once", name, s);
+		temp_free(e, s);
+	}
+	start_tally(e);
+
+	pw = temp_alloc(e, (size_t)n * n, sizeof pw[0]);
+	get_ints(e, fp, name, pw, (size_t)n * n);
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			if (pw[(size_t)i * n + j] < 0 || pw[(size_t)i * n + j] > voters ||
+			    (i == j && pw[(size_t)i * n + j]))
+				fail(e, "%s has a bad pairwise count", name);
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			e->pairwise[(size_t)map[i] * n + map[j]] += pw[(size_t)i * n + j];
+	get_ints(e, fp, name, pw, n);
+	for (i = 0; i < n; i++)
+		if (pw[i] < 0 || pw[i] > voters)
+			fail(e, "%s has a bad mention count", name);
+	for (i = 0; i < n; i++)
+		e->mentions[map[i]] += pw[i];
+	e->num_voters += voters;
+
+	temp_free(e, pw);
+	temp_free(e, map);
+	temp_free(e, seen);
+	return 0;
+}
+
+/*
+ * By how many voters is candidate a preferred to candidate b?
+ * Negative if b is preferred.
+ * In a sparse tally, a voter who ranked a but not b preferred a, so
+ * of the mentions of a, all but those ranking both count for a; the
+ * same goes for b, and the voters ranking both cancel out.
+ */
+static int
+margin(struct election_s *e, int a, int b)
+{
+	if (e->sparse)
+		return (long long)pair_diff(e, a, b) + e->mentions[a] - e->mentions[b];
+	return e->pairwise[(size_t)a * e->num_candidates + b] -
+		e->pairwise[(size_t)b * e->num_candidates + a];
+}
+
+/*
+ * find out who is prefered to who by how much.
+ * Each majority is the difference of its two pairwise entries.
+ * With a sparse tally, candidates nobody ranked get no majorities, as
+ * pull_unranked_losers() would only take them out again.  They all tie
+ * each other, and beat nobody else, so their ties are still counted.
+ * The rest still get one for each pair, ranked together or not, so
+ * more than about 65000 of them are refused.
+ */
+static void
+create_majorities(struct election_s *e)
+{
+	int i, j;
+	int t;
+	int nc = e->num_candidates;
+	int na;
+	int *list;
+	long long ties;
+	struct majority_s *mp;
+
+	e->active = zalloc(e, nc, sizeof e->active[0]);
+	list = temp_alloc(e, nc, sizeof list[0]);
+	na = 0;
+	for (i = 0; i < nc; i++)
+		if (!e->sparse || e->mentions[i]) {
+			e->active[i] = 1;
+			list[na++] = i;
+		}
+	e->num_active = na;
+
+	// init the array.  One entry for each pair of candidates.
+	if ((size_t)na * (na - 1) / 2 > INT_MAX)
+		fail(e, "%d candidates make more than %d majorities", na, INT_MAX);
+	e->majorities = zalloc(e, (size_t)na * (na - 1) / 2,
+		sizeof e->majorities[0]);
+	mp = e->majorities;
+	for (i = 0; i < na - 1; i++)
+		for (j = i + 1; j < na; j++) {
+			mp->c1 = list[i];
+			mp->c2 = list[j];
+			mp++;
+		}
+	temp_free(e, list);
+
+	e->num_majorities = (size_t)na * (na - 1) / 2;
+	e->majorities_len = e->num_majorities;
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		mp->strength = margin(e, mp->c1, mp->c2);
+
+	/*
+	 * Loop over all majorities.
+	 * Count the number of tie votes.
+	 * Normalize the majorities so c1 always wins.
+	 */
+	ties = (long long)(nc - na) * (nc - na - 1) / 2;
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		if (mp->strength == 0)
+			ties++;
+		else if (mp->strength < 0) {
+			t = mp->c1;
+			mp->c1 = mp->c2;
+			mp->c2 = t;
+			mp->strength = -mp->strength;
+		}
+	if (ties && e->verbose)
+		fprintf(e->log, "Warning: %lld ties were found.\n", ties);
+}
+
+/* DEBUGGING ROUTINE */
+static void
+check_majorities(struct election_s *e, char *s)
+{
+	int i;
+	struct majority_s *mp;
+
+	fprintf(e->log, "checking majorities: %s\n", s);
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		if (mp->c1 == mp->c2)
+			fail(e, "majority %d is bad (%d)", i, mp->c1);
+}
+
+/*
+ * return 0 if cannot figure out two majorities
+ * return -1 if first majority is more important than second.
+ * return 1 if second majority is more important than first
+ *
+ * Record if we ever returned 0.
+ */
+static int
+compar(struct election_s *e, const struct majority_s *mp, const struct majority_s *mq)
+{
+	int lp, lq;
+	int m;
+
+	e->counts.compar++;
+	if (mp->strength > mq->strength)
+		return -1;
+	if (mp->strength < mq->strength)
+		return 1;
+
+	/*
+	 * Tie.  Look to race between losers.
+	 */
+	lp = mp->c2;
+	lq = mq->c2;
+
+	/*
+	 * Call it a tie if both won against the same loser
+	 */
+	if (lp == lq) {
+		e->ranking_tie = 1;
+		return 0;
+	}
+
+	/*
+	 * Look up the race that was between the losers.
+	 * If the losers tied, then we are tied.
+	 */
+	m = margin(e, lq, lp);
+	if (m == 0) {
+		e->ranking_tie = 1;
+		return 0;
+	}
+
+	/*
+	 * P wins if Q's loser beats P's loser.
+	 */
+	if (m > 0)
+		return -1;
+	return 1;
+}
+
+/*
+ * Drop the majorities of removed candidates from majorities[].
+ * The survivors keep their order.
+ */
+static void
+live_majorities(struct election_s *e)
+{
+	int i;
+	struct majority_s *mp, *np;
+
+	if (e->majorities_len == e->num_majorities)
+		return;
+	e->counts.compactions++;
+	np = e->majorities;
+	for (i = 0, mp = e->majorities; i < e->majorities_len; i++, mp++)
+		if (e->active[mp->c1] && e->active[mp->c2])
+			*np++ = *mp;
+	e->majorities_len = np - e->majorities;
+	if (e->majorities_len != e->num_majorities)
+		fail(e, "internal error in live_majorities.");
+}
+
+/*
+ * Take a candidate out of the running.
+ * It had a majority with each of the other active candidates.
+ */
+static void
+remove_pairings(struct election_s *e, struct candidate_s *cp)
+{
+	int c;
+
+	c = cp - e->candidates;
+	if (!e->active[c])
+		return;
+	e->counts.remove_pairings++;
+	e->active[c] = 0;
+	e->num_active--;
+	e->num_majorities -= e->num_active;
+}
+
+/*
+ * Stable sort of majorities by strength, strongest first.
+ * Strengths are never negative, so this is an LSD radix sort,
+ * a byte at a time.  A byte that is the same everywhere is skipped.
+ * tmp must have room for n majorities.
+ */
+static void
+sort_by_strength(struct majority_s *m, int n, struct majority_s *tmp)
+{
+	int i, shift;
+	int b, sum, t;
+	int count[256];
+	struct majority_s *src, *dst, *swap;
+
+	src = m;
+	dst = tmp;
+	for (shift = 0; shift < 32; shift += 8) {
+		// bucket 0 holds the biggest digit.
+		memset(count, 0, sizeof count);
+		for (i = 0; i < n; i++)
+			count[255 - ((src[i].strength >> shift) & 0xff)]++;
+		for (b = 0; b < 256 && count[b] != n; b++)
+			;
+		if (b < 256)
+			continue;	// only one digit value
+		for (b = 0, sum = 0; b < 256; b++) {
+			t = count[b];
+			count[b] = sum;
+			sum += t;
+		}
+		for (i = 0; i < n; i++)
+			dst[count[255 - ((src[i].strength >> shift) & 0xff)]++] = src[i];
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != m)
+		memcpy(m, src, n * sizeof m[0]);
+}
+
+/*
+ * Rows of the reachability bitsets of the election e in scope.
+ */
+#define	ROW(b, x)	((b) + (size_t)(x) * e->num_words)
+#define	TEST(row, y)	(((row)[(y) >> 6] >> ((y) & 63)) & 1)
+#define	SET(row, y)	((row)[(y) >> 6] |= (uint64_t)1 << ((y) & 63))
+
+/*
+ * The first bit set in row at or after bit from, or -1.  The row is
+ * n bits long, and any bits past that are clear.
+ */
+static int
+next_bit(const uint64_t *row, int from, int n)
+{
+	int w;
+	uint64_t bits;
+
+	if (from >= n)
+		return -1;
+	w = from >> 6;
+	bits = row[w] & (~(uint64_t)0 << (from & 63));
+	while (!bits) {
+		if (++w * 64 >= n)
+			return -1;
+		bits = row[w];
+	}
+	return w * 64 + __builtin_ctzll(bits);
+}
+
+/*
+ * The order within a run of equal strength majorities.
+ * compar() puts m[i] before m[j] when m[j]'s loser beats m[i]'s, but
+ * that is not transitive, and it can go round in a cycle.  So the
+ * losers are taken as a graph, with an edge from x to y when y beats
+ * x, and its strongly connected components are found.  m[i] must come
+ * before m[j] if a path leads from m[i]'s loser's component to m[j]'s;
+ * majorities whose losers share a component are free of each other.
+ */
+struct run_s {
+	struct majority_s *m;
+	int k;
+	int nl;			// distinct losers
+	int *loser;		// the losers, in the order they come
+	int *slot;		// slot[c]: c's index in loser[], -1 if none
+	int lw;			// words in a row of beats[]
+	uint64_t *beats;	// row x has bit y set if loser y beats loser x
+	int nscc;
+	int *scc;		// scc[x]: loser x's component; edges go forward
+	int rw;			// words in a row of leads[]
+	uint64_t *leads;	// for the search; see run_leads()
+};
+
+#define	LOSER_SCC(rp, i)	((rp)->scc[(rp)->slot[(rp)->m[i].c2]])
+
+/*
+ * Number the components of the run's losers, in an order that all
+ * the edges go forward in.  Tarjan's algorithm, with its own stacks.
+ */
+static void
+run_components(struct election_s *e, struct run_s *rp)
+{
+	int r, x, y, n, sp, top, id;
+	int nl = rp->nl;
+	int *index, *low, *stack, *call, *next;
+	char *on;
+
+	index = temp_alloc(e, nl, sizeof index[0]);
+	low = temp_alloc(e, nl, sizeof low[0]);
+	stack = temp_alloc(e, nl, sizeof stack[0]);
+	call = temp_alloc(e, nl, sizeof call[0]);
+	next = temp_alloc(e, nl, sizeof next[0]);
+	on = temp_alloc(e, nl, sizeof on[0]);
+	n = top = id = 0;
+	for (r = 0; r < nl; r++) {
+		if (index[r])
+			continue;
+		sp = 0;
+		call[sp++] = r;
+		index[r] = low[r] = ++n;
+		stack[top++] = r;
+		on[r] = 1;
+		while (sp > 0) {
+			x = call[sp - 1];
+			y = next_bit(rp->beats + (size_t)x * rp->lw, next[x], nl);
+			if (y >= 0) {
+				next[x] = y + 1;
+				if (!index[y]) {
+					call[sp++] = y;
+					index[y] = low[y] = ++n;
+					stack[top++] = y;
+					on[y] = 1;
+				} else if (on[y] && index[y] < low[x])
+					low[x] = index[y];
+				continue;
+			}
+			sp--;
+			if (low[x] == index[x]) {
+				do {
+					y = stack[--top];
+					on[y] = 0;
+					rp->scc[y] = id;
+				} while (y != x);
+				id++;
+			}
+			if (sp > 0 && low[x] < low[call[sp - 1]])
+				low[call[sp - 1]] = low[x];
+		}
+	}
+	// a component is finished after the ones it leads to; turn it round.
+	for (x = 0; x < nl; x++)
+		rp->scc[x] = id - 1 - rp->scc[x];
+	rp->nscc = id;
+	temp_free(e, index);
+	temp_free(e, low);
+	temp_free(e, stack);
+	temp_free(e, call);
+	temp_free(e, next);
+	temp_free(e, on);
+}
+
+/*
+ * Find the losers of the run m[0..k), who beats who among them, and
+ * their components.  slot[] must be all -1, num_candidates long;
+ * run_close() leaves it that way again.
+ */
+static void
+run_open(struct election_s *e, struct run_s *rp, struct majority_s *m, int k, int *slot)
+{
+	int i, x, y, d;
+	uint64_t *row;
+
+	rp->m = m;
+	rp->k = k;
+	rp->slot = slot;
+	rp->loser = temp_alloc(e, k, sizeof rp->loser[0]);
+	rp->nl = 0;
+	for (i = 0; i < k; i++)
+		if (slot[m[i].c2] < 0) {
+			slot[m[i].c2] = rp->nl;
+			rp->loser[rp->nl++] = m[i].c2;
+		}
+	rp->lw = (rp->nl + 63) / 64;
+	rp->beats = temp_alloc(e, (size_t)rp->nl * rp->lw, sizeof rp->beats[0]);
+	for (x = 0; x < rp->nl; x++) {
+		row = rp->beats + (size_t)x * rp->lw;
+		for (y = x + 1; y < rp->nl; y++) {
+			e->counts.compar++;
+			d = margin(e, rp->loser[y], rp->loser[x]);
+			if (d > 0)
+				SET(row, y);
+			else if (d < 0)
+				SET(rp->beats + (size_t)y * rp->lw, x);
+		}
+	}
+	rp->scc = temp_alloc(e, rp->nl, sizeof rp->scc[0]);
+	rp->leads = NULL;
+	run_components(e, rp);
+}
+
+static void
+run_close(struct election_s *e, struct run_s *rp)
+{
+	int x;
+
+	for (x = 0; x < rp->nl; x++)
+		rp->slot[rp->loser[x]] = -1;
+	temp_free(e, rp->loser);
+	temp_free(e, rp->beats);
+	temp_free(e, rp->scc);
+	temp_free(e, rp->leads);
+}
+
+/*
+ * A binary heap of components, the one whose next majority comes
+ * first on top.
+ */
+static void
+heap_down(int *heap, int n, const int *key, int i)
+{
+	int j, t;
+
+	for (; (j = 2 * i + 1) < n; i = j) {
+		if (j + 1 < n && key[heap[j + 1]] < key[heap[j]])
+			j++;
+		if (key[heap[i]] <= key[heap[j]])
+			break;
+		t = heap[i];
+		heap[i] = heap[j];
+		heap[j] = t;
+	}
+}
+
+static void
+heap_up(int *heap, const int *key, int i)
+{
+	int t;
+
+	for (; i > 0 && key[heap[(i - 1) / 2]] > key[heap[i]]; i = (i - 1) / 2) {
+		t = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = t;
+	}
+}
+
+/*
+ * Put the run in the order that keeps all that must come before what,
+ * and is nearest the one it came in: at each step, the first majority
+ * that may come next.  A component may come next once the components
+ * with edges into it have all come.  order[] gets the indices.
+ */
+static void
+run_order(struct election_s *e, struct run_s *rp, int *order)
+{
+	int i, n, s, t, x, y, nh;
+	int k = rp->k, nl = rp->nl, ns = rp->nscc;
+	int *npred, *first, *list, *lfirst, *llist, *key, *heap, *head;
+
+	npred = temp_alloc(e, ns, sizeof npred[0]);
+	first = temp_alloc(e, ns + 1, sizeof first[0]);
+	list = temp_alloc(e, k, sizeof list[0]);
+	lfirst = temp_alloc(e, ns + 1, sizeof lfirst[0]);
+	llist = temp_alloc(e, nl, sizeof llist[0]);
+	key = temp_alloc(e, ns, sizeof key[0]);
+	heap = temp_alloc(e, ns, sizeof heap[0]);
+	head = temp_alloc(e, ns, sizeof head[0]);
+
+	// the majorities, and the losers, of each component in order.
+	for (i = 0; i < k; i++)
+		first[LOSER_SCC(rp, i) + 1]++;
+	for (x = 0; x < nl; x++)
+		lfirst[rp->scc[x] + 1]++;
+	for (s = 0; s < ns; s++) {
+		first[s + 1] += first[s];
+		lfirst[s + 1] += lfirst[s];
+	}
+	for (i = 0; i < k; i++)
+		list[first[LOSER_SCC(rp, i)]++] = i;
+	for (x = 0; x < nl; x++)
+		llist[lfirst[rp->scc[x]]++] = x;
+	for (s = ns; s > 0; s--) {
+		first[s] = first[s - 1];
+		lfirst[s] = lfirst[s - 1];
+	}
+	first[0] = lfirst[0] = 0;
+	memcpy(head, first, ns * sizeof head[0]);
+
+	for (x = 0; x < nl; x++)
+		for (y = next_bit(rp->beats + (size_t)x * rp->lw, 0, nl); y >= 0;
+		     y = next_bit(rp->beats + (size_t)x * rp->lw, y + 1, nl))
+			if (rp->scc[y] != rp->scc[x])
+				npred[rp->scc[y]]++;
+	nh = 0;
+	for (s = 0; s < ns; s++)
+		if (!npred[s]) {
+			key[s] = list[head[s]];
+			heap[nh] = s;
+			heap_up(heap, key, nh++);
+		}
+
+	n = 0;
+	while (nh > 0) {
+		s = heap[0];
+		order[n++] = list[head[s]++];
+		if (head[s] < first[s + 1]) {
+			key[s] = list[head[s]];
+			heap_down(heap, nh, key, 0);
+			continue;
+		}
+		heap[0] = heap[--nh];
+		heap_down(heap, nh, key, 0);
+		for (i = lfirst[s]; i < lfirst[s + 1]; i++) {
+			x = llist[i];
+			for (y = next_bit(rp->beats + (size_t)x * rp->lw, 0, nl); y >= 0;
+			     y = next_bit(rp->beats + (size_t)x * rp->lw, y + 1, nl)) {
+				t = rp->scc[y];
+				if (t != s && --npred[t] == 0) {
+					key[t] = list[head[t]];
+					heap[nh] = t;
+					heap_up(heap, key, nh++);
+				}
+			}
+		}
+	}
+	if (n != k)
+		fail(e, "internal error in run_order.");
+
+	temp_free(e, npred);
+	temp_free(e, first);
+	temp_free(e, list);
+	temp_free(e, lfirst);
+	temp_free(e, llist);
+	temp_free(e, key);
+	temp_free(e, heap);
+	temp_free(e, head);
+}
+
+/*
+ * Is the run's order, once run_order() has put it in place, the only
+ * one allowed?  Not if two majorities share a loser, or two losers are
+ * in one component; otherwise only if each majority's loser is beaten
+ * by the next one's.
+ */
+static int
+run_unique(struct run_s *rp)
+{
+	int i, x, y;
+
+	if (rp->nl < rp->k || rp->nscc < rp->nl)
+		return 0;
+	for (i = 1; i < rp->k; i++) {
+		x = rp->slot[rp->m[i - 1].c2];
+		y = rp->slot[rp->m[i].c2];
+		if (!TEST(rp->beats + (size_t)x * rp->lw, y))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Sort the majorities, most important first.
+ * Radix sort by strength, then put each run of equal strength in
+ * order with the races between the losers; see run_order().  The
+ * order is fully determined by the input.
+ * ranking_tie is set if two neighbours in the result are not ordered
+ * by compar(), or are ordered the other way, which only a cycle allows.
+ * It is also set if some other order of a run is allowed; see
+ * run_unique().
+ */
+static void
+do_sort(struct election_s *e)
+{
+	int i, j, end;
+	int *slot, *order;
+	struct majority_s *m;
+	struct majority_s *tmp;
+	struct run_s run;
+
+	live_majorities(e);
+	m = e->majorities;
+	tmp = temp_alloc(e, e->num_majorities, sizeof tmp[0]);
+	sort_by_strength(m, e->num_majorities, tmp);
+	slot = temp_alloc(e, e->num_candidates, sizeof slot[0]);
+	for (i = 0; i < e->num_candidates; i++)
+		slot[i] = -1;
+	order = temp_alloc(e, e->num_majorities, sizeof order[0]);
+	for (i = 0; i < e->num_majorities; i = end) {
+		for (end = i + 1; end < e->num_majorities && m[end].strength == m[i].strength; end++)
+			;
+		if (end - i == 1)
+			continue;
+		run_open(e, &run, m + i, end - i, slot);
+		if (run.nl > 1) {
+			run_order(e, &run, order);
+			for (j = 0; j < end - i; j++)
+				tmp[j] = m[i + order[j]];
+			memcpy(m + i, tmp, (end - i) * sizeof m[0]);
+		}
+		if (!run_unique(&run))
+			e->ranking_tie = 1;
+		run_close(e, &run);
+	}
+	temp_free(e, tmp);
+	temp_free(e, slot);
+	temp_free(e, order);
+
+	for (i = 1; i < e->num_majorities; i++)
+		if (compar(e, &m[i - 1], &m[i]) > 0)
+			e->ranking_tie = 1;
+}
+
+/*
+ * How many pairs of majorities does compar() call a tie?
+ * Sorts a copy of the majorities by strength, then walks each run of
+ * equal strength once.
+ * Within a run, two majorities tie if they have the same loser,
+ * or if their losers tied each other, so count by loser.
+ */
+static long long
+count_tied_majorities(struct election_s *e)
+{
+	int i, j, k, end;
+	int nl;
+	int n;
+	int *count;
+	int *losers;
+	long long ties;
+	struct majority_s *m;
+
+	live_majorities(e);
+	n = e->num_majorities;
+	m = temp_alloc(e, 2 * (size_t)n, sizeof m[0]);
+	memcpy(m, e->majorities, n * sizeof m[0]);
+	sort_by_strength(m, n, m + n);
+	count = temp_alloc(e, e->num_candidates, sizeof count[0]);
+	losers = temp_alloc(e, e->num_candidates, sizeof losers[0]);
+	ties = 0;
+	for (i = 0; i < n; i = end) {
+		nl = 0;
+		for (end = i; end < n && m[end].strength == m[i].strength; end++)
+			if (count[m[end].c2]++ == 0)
+				losers[nl++] = m[end].c2;
+		for (j = 0; j < nl; j++) {
+			ties += (long long)count[losers[j]] * (count[losers[j]] - 1) / 2;
+			for (k = j + 1; k < nl; k++)
+				if (margin(e, losers[j], losers[k]) == 0)
+					ties += (long long)count[losers[j]] * count[losers[k]];
+		}
+		for (j = 0; j < nl; j++)
+			count[losers[j]] = 0;
+	}
+	temp_free(e, m);
+	temp_free(e, count);
+	temp_free(e, losers);
+	return ties;
+}
+
+static void
+pull_unranked_losers(struct election_s *e)
+{
+	int i;
+	int count;
+	struct candidate_s *cp;
+
+	count = 0;
+	// loop over all canidates not already ranked.
+	for (i = 0, cp = e->candidates; i < e->num_candidates; i++, cp++)
+		if (!cp->ranking_source) {
+			// did any voter give this candidate a rank?
+			if (!e->mentions[i]) {
+				// candidate was unranked
+				cp->ranking_source = RANKING_LOSER;
+				cp->ranking_phase = e->ranking_phase;
+				count++;
+			}
+		}
+
+	// loop over all candidates give the RANKING_LOSER status
+	if (count) {
+		e->next_loser -= count - 1;
+		for (i = 0, cp = e->candidates; i < e->num_candidates; i++, cp++)
+			if (cp->ranking_source == RANKING_LOSER) {
+				cp->ranking = e->next_loser;
+				remove_pairings(e, cp);
+			}
+		e->next_loser--;
+		e->ranking_phase++;
+	}
+}
+
+/*
+ * If any of the candidates are Condorcet winners, because they beat all others,
+ * or Condorcet losers, because they are beat by all others, then
+ * we know their rankings.
+ *
+ * returns true if any candidates were found and pulled out.
+ */
+static int
+pull_condorcet(struct election_s *e)
+{
+	int i;
+	int count;
+	struct majority_s *mp;
+	struct candidate_s *cp, *wp, *lp;
+	struct candidate_s *candidates = e->candidates;
+
+	live_majorities(e);
+	for (i = 0, cp = candidates; i < e->num_candidates; i++, cp++) {
+		cp->wins_pair = 0;
+		cp->loses_pair = 0;
+		cp->ties = 0;
+	}
+
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		if (mp->strength) {
+			candidates[mp->c1].wins_pair = 1;
+			candidates[mp->c2].loses_pair = 1;
+		} else {
+			candidates[mp->c1].ties = 1;
+			candidates[mp->c2].ties = 1;
+		}
+
+
+	// how many only win, never lose?
+	count = 0;
+	wp = NULL;
+	for (i = 0, cp = candidates; i < e->num_candidates; i++, cp++)
+		if (cp->wins_pair && !cp->loses_pair && !cp->ties) {
+			count++;
+			wp = cp;
+		}
+
+	// If we have exactly one winner, they are the Condorcet winner.
+	if (count == 1) {
+		wp->ranking = e->next_winner++;
+		wp->ranking_source = RANKING_C_WINNER;
+		wp->ranking_phase = e->ranking_phase;
+	} else
+		wp = NULL;
+
+	// how many only lose, never win??
+	count = 0;
+	lp = NULL;
+	for (i = 0, cp = candidates; i < e->num_candidates; i++, cp++)
+		if (!cp->wins_pair && cp->loses_pair && cp->ties) {
+			count++;
+			lp = cp;
+		}
+
+	// If we have exactly one loser, they are the Condorcet loser.
+	if (count == 1) {
+		lp->ranking = e->next_loser--;
+		lp->ranking_source = RANKING_C_LOSER;
+		lp->ranking_phase = e->ranking_phase;
+	} else
+		lp = NULL;
+
+	count = 0;
+	if (wp) {
+		remove_pairings(e, wp);
+		count++;
+	}
+	if (lp) {
+		remove_pairings(e, lp);
+		count++;
+	}
+	if (wp || lp)
+		e->ranking_phase++;
+	return count;
+}
+
+/*
+ * Is there a path from c2 to c1?
+ */
+static int
+path_to(struct election_s *e, int c1, int c2)
+{
+	e->counts.path_to++;
+	return TEST(ROW(e->reach, c2), c1);
+}
+
+/*
+ * dst |= src, over one row of n words.
+ */
+static void
+or_row(uint64_t *dst, const uint64_t *src, int n)
+{
+	int w;
+
+	for (w = 0; w < n; w++)
+		dst[w] |= src[w];
+}
+
+/*
+ * Add the arc x->y to the graph.
+ * Everything that reaches x (and x) now reaches y and everything y reaches.
+ * A row that already reaches y already has all of that, so it is
+ * skipped; every row updated gains at least one bit, which bounds the
+ * whole lock at C * C row updates.
+ */
+static void
+add_arc(struct election_s *e, int x, int y)
+{
+	int w, u;
+	int nw = e->num_words;
+	uint64_t bits;
+	uint64_t *from, *to;
+
+	if (TEST(ROW(e->reach, x), y))
+		return;		// nothing new.
+
+	from = e->reach_scratch;
+	to = e->reach_scratch + nw;
+	memcpy(from, ROW(e->reached_by, x), nw * sizeof from[0]);
+	SET(from, x);
+	memcpy(to, ROW(e->reach, y), nw * sizeof to[0]);
+	SET(to, y);
+
+	for (w = 0; w < nw; w++)
+		for (bits = from[w]; bits; bits &= bits - 1) {
+			u = w * 64 + __builtin_ctzll(bits);
+			if (TEST(ROW(e->reach, u), y))
+				continue;
+			or_row(ROW(e->reach, u), to, nw);
+			e->counts.arc_rows++;
+		}
+	for (w = 0; w < nw; w++)
+		for (bits = to[w]; bits; bits &= bits - 1) {
+			u = w * 64 + __builtin_ctzll(bits);
+			if (TEST(ROW(e->reached_by, u), x))
+				continue;
+			or_row(ROW(e->reached_by, u), from, nw);
+			e->counts.arc_rows++;
+		}
+}
+
+/*
+ * This routine "locks" all pairings that can be locked.
+ * Pairings are locked in turn, provided they do not create
+ * a cycle in the graph.
+ * Returns the number locked.
+ */
+static int
+do_lock(struct election_s *e)
+{
+	int i;
+	int locked;
+	int nc = e->num_candidates;
+	struct majority_s *mp;
+
+	live_majorities(e);
+	e->num_words = (nc + 63) / 64;
+	free(e->reach);
+	free(e->reached_by);
+	free(e->reach_scratch);
+	e->reach = e->reached_by = e->reach_scratch = NULL;
+	e->reach = zalloc(e, (size_t)nc * e->num_words, sizeof e->reach[0]);
+	e->reached_by = zalloc(e, (size_t)nc * e->num_words, sizeof e->reached_by[0]);
+	e->reach_scratch = zalloc(e, 2 * e->num_words, sizeof e->reach_scratch[0]);
+
+	locked = 0;
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		if (!path_to(e, mp->c1, mp->c2)) {
+			mp->locked++;
+			add_arc(e, mp->c1, mp->c2);
+			locked++;
+		}
+	return locked;
+}
+
+/*
+ * Find all the winners by the ranked pairs method, phase by phase.
+ *
+ * The winners of a phase are the candidates with no locked arc coming in.
+ * Taking them out never changes which of the remaining pairings would
+ * be locked, since no path runs through a candidate nothing points to.
+ * So the graph is locked once, and each phase just peels off the next
+ * layer of it.
+ */
+static void
+find_rp_winners(struct election_s *e, int locked)
+{
+	int i, j, c;
+	int count;
+	int nc = e->num_candidates;
+	int *indegree;
+	int *first;
+	int *arcs;
+	int *tier;
+	struct majority_s *mp;
+	struct candidate_s *cp;
+
+	// the locked arcs out of each candidate.
+	indegree = temp_alloc(e, nc, sizeof indegree[0]);
+	first = temp_alloc(e, nc + 1, sizeof first[0]);
+	arcs = temp_alloc(e, locked, sizeof arcs[0]);
+	tier = temp_alloc(e, nc, sizeof tier[0]);
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		if (mp->locked) {
+			first[mp->c1 + 1]++;
+			indegree[mp->c2]++;
+		}
+	for (c = 0; c < nc; c++)
+		first[c + 1] += first[c];
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		if (mp->locked)
+			arcs[first[mp->c1]++] = mp->c2;
+	for (c = nc; c > 0; c--)
+		first[c] = first[c - 1];
+	first[0] = 0;
+
+	while (e->num_majorities) {
+		if (e->verbose)
+			fprintf(e->log, "%d pairings were locked, %d were not locked.\n",
+				locked, e->num_majorities - locked);
+
+		count = 0;
+		for (c = 0; c < nc; c++)
+			if (e->active[c] && !indegree[c])
+				tier[count++] = c;
+		for (i = 0; i < count; i++) {
+			c = tier[i];
+			cp = &e->candidates[c];
+			cp->ranking = e->next_winner;
+			cp->ranking_source = RANKING_T_WINNER;
+			cp->ranking_phase = e->ranking_phase;
+			remove_pairings(e, cp);
+			for (j = first[c]; j < first[c + 1]; j++)
+				if (e->active[arcs[j]]) {
+					indegree[arcs[j]]--;
+					locked--;
+				}
+		}
+		e->next_winner += count;
+		if (e->verbose)
+			fprintf(e->log, "Ranked pairs yielded %d winners at phase %d\n",
+				count, e->ranking_phase+1);
+		if (count)
+			e->ranking_phase++;
+	}
+	temp_free(e, indegree);
+	temp_free(e, first);
+	temp_free(e, arcs);
+	temp_free(e, tier);
+}
+
+/*
+ * All candidates not yet ranked are tied for middle.
+ * If the sort found ties, every candidate from the first ranked pairs
+ * phase on is marked as tied.
+ */
+static void
+finish_rankings(struct election_s *e)
+{
+	int i;
+	int count;
+	int source;
+	struct candidate_s *cp;
+
+	source = RANKING_NONE;
+	count = 0;
+	for (i = 0, cp = e->candidates; i < e->num_candidates; i++, cp++)
+		if (!cp->ranking_source)
+			count++;
+	if (count == 1)
+		source = RANKING_T_LOSER;
+
+	for (i = 0, cp = e->candidates; i < e->num_candidates; i++, cp++) {
+		if (!cp->ranking_source) {
+			cp->ranking_source = source;
+			cp->ranking = e->next_winner;
+			cp->ranking_phase = e->ranking_phase;
+		}
+	}
+
+	e->ranking_tie_phase = -1;
+	if (e->ranking_tie)
+		for (i = 0, cp = e->candidates; i < e->num_candidates; i++, cp++)
+			if (cp->ranking_source == RANKING_T_WINNER &&
+			    (e->ranking_tie_phase < 0 || cp->ranking_phase < e->ranking_tie_phase))
+				e->ranking_tie_phase = cp->ranking_phase;
+}
+
+/*
+ * Tied outcomes.
+ * When equal strength majorities cannot be ordered, do_sort() picks
+ * one order, and that order can change which of them are locked.
+ * find_outcomes() follows every order instead.
+ *
+ * The orders searched are those that keep what run_order() keeps:
+ * the majorities of one component of a run's losers before those of
+ * any component it leads to.  The run is cut into tie blocks where
+ * every majority before the cut must come before every one after it,
+ * and the search keeps a frontier of lock graphs and goes through the
+ * blocks in turn.  A block of one majority is locked, or not, in each
+ * graph in place.
+ *
+ * Orders of a block are not tried one by one.  Whatever the order, the
+ * majorities it locks close no cycle with the graph, and each one it
+ * leaves is blocked by the graph and those locked before it.  So
+ * search_block() decides, a majority at a time, to lock it or to leave
+ * it, and drops a branch once a majority left could no longer be
+ * blocked by ones that may come before it.  schedule() then checks
+ * that some order allowed gives what was decided.  A block that every
+ * order locks whole is locked at once.  The graphs at the end of the
+ * block are merged when they are the same.
+ *
+ * Only the reach bitsets are kept, since what locks next and the layers
+ * find_rp_winners() peels off both depend only on what reaches what.
+ * At the end each graph is peeled into a ranking, and the distinct
+ * rankings kept.
+ *
+ * At most outcome_max lock graphs are kept, as many as fit in
+ * outcome_limit kilobytes, whatever the number of candidates makes
+ * their size.  Those search_block() works on count as kept while it
+ * holds them.  The rest of the work, from finding the components to
+ * each node of the search, is counted in steps, at most OUTCOME_STEPS
+ * for each byte of outcome_limit.  Past either limit each block is
+ * only locked in the sorted order, and outcomes_cut is set.  The first ranking is
+ * always the sorted order's, which do_lock() gives; do_sort() puts
+ * each run in an order that is allowed.
+ */
+#define	OUTCOME_STEPS	8
+#define	CLEAR(row, y)	((row)[(y) >> 6] &= ~((uint64_t)1 << ((y) & 63)))
+
+/*
+ * A tie block being searched: k majorities m[0..k), whose losers are
+ * in ns components of the run.  Row s of after[] has bit t set if the
+ * majorities of component s must come before those of component t.
+ * The rows are sw words.  state[i] is what the search has done with
+ * m[i], starting from the lock graph g0.
+ */
+struct tie_block_s {
+	struct majority_s *m;
+	int k;
+	int ns;
+	int sw;
+	int *scc;		// scc[i]: the component of m[i]'s loser
+	uint64_t *after;
+	int *first;		// component s has member[first[s]..first[s + 1])
+	int *member;
+	int *waits;		// per component: how many must come before it
+	int *wait;		// the same, less those placed
+	int *todo;		// 2k, for schedule()
+	char *state;
+	uint64_t *g0;
+	int found;		// the search gave at least one graph
+	int *at;		// the search's stack: the majority each level decides
+	int *depth;		// how many the level's graph has locked; see pool[]
+	char *step;		// how far each level has got
+	uint64_t **pool;	// the graph for each depth d, at pool[d - 1]
+	int num_pool;
+};
+
+#define	SEARCH_ENTER	0	// not started
+#define	SEARCH_LOCKED	1	// m[i] locked, if it could be
+#define	SEARCH_LEFT	2	// m[i] left as well, if it could be
+
+#define	TIE_OPEN	0	// not decided yet
+#define	TIE_LOCK	1
+#define	TIE_LEAVE	2	// to be blocked by ones locked before it
+#define	TIE_BLOCKED	3	// blocked by the graph at the start
+
+#define	BROW(rows, s)	((rows) + (size_t)(s) * tb->sw)
+
+/*
+ * Hash a blob a word at a time, then mix well, since the blobs are
+ * mostly zeroes and the table takes the low bits.
+ */
+static unsigned
+blob_hash(const char *p, size_t len)
+{
+	size_t i;
+	uint64_t h, w;
+
+	h = len;
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	for (; i < len; i++)
+		h = (h ^ (unsigned char)p[i]) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/*
+ * Add a copy of p to the set.
+ * Returns 1 if it is new, 0 if it was there already.
+ */
+static int
+blob_add(struct election_s *e, struct blobset_s *sp, const void *p)
+{
+	int i;
+	unsigned h, size;
+	char *b;
+
+	if (2 * (unsigned)(sp->count + 1) > (sp->slot ? sp->mask + 1 : 0)) {
+		size = sp->slot ? 2 * (sp->mask + 1) : 64;
+		free(sp->slot);
+		sp->slot = NULL;
+		sp->slot = zalloc(e, size, sizeof sp->slot[0]);
+		sp->mask = size - 1;
+		for (i = 0; i < sp->count; i++) {
+			for (h = blob_hash(sp->list[i], sp->len) & sp->mask;
+			     sp->slot[h];
+			     h = (h + 1) & sp->mask)
+				;
+			sp->slot[h] = sp->list[i];
+		}
+	}
+	for (h = blob_hash(p, sp->len) & sp->mask; sp->slot[h]; h = (h + 1) & sp->mask)
+		if (memcmp(sp->slot[h], p, sp->len) == 0)
+			return 0;
+	sp->list = grow(e, sp->list, &sp->alloc, sp->count + 1, sizeof sp->list[0]);
+	b = zalloc(e, 1, sp->len);
+	memcpy(b, p, sp->len);
+	sp->slot[h] = b;
+	sp->list[sp->count++] = b;
+	return 1;
+}
+
+/*
+ * Empty the set, freeing the blobs.
+ */
+static void
+blob_clear(struct blobset_s *sp)
+{
+	int i;
+
+	for (i = 0; i < sp->count; i++)
+		free(sp->list[i]);
+	free(sp->slot);
+	free(sp->list);
+	sp->slot = NULL;
+	sp->list = NULL;
+	sp->count = sp->alloc = 0;
+}
+
+static void
+free_frontier(struct election_s *e)
+{
+	int i;
+
+	for (i = 0; i < e->num_frontier; i++)
+		free(e->frontier[i]);
+	free(e->frontier);
+	e->frontier = NULL;
+	e->num_frontier = 0;
+}
+
+/*
+ * The graphs at the end of a tie block become the frontier.
+ */
+static void
+next_frontier(struct election_s *e)
+{
+	free_frontier(e);
+	e->frontier = (uint64_t **)e->next.list;
+	e->num_frontier = e->next.count;
+	free(e->next.slot);
+	e->next.slot = NULL;
+	e->next.list = NULL;
+	e->next.count = e->next.alloc = 0;
+}
+
+/*
+ * Point the reach bitsets at the lock graph g.
+ */
+static void
+use_graph(struct election_s *e, uint64_t *g)
+{
+	e->reach = g;
+	e->reached_by = g + (size_t)e->num_candidates * e->num_words;
+}
+
+/*
+ * Count a lock graph kept, and stop searching once there are too many.
+ */
+static void
+count_graph(struct election_s *e)
+{
+	if (++e->outcome_graphs + e->outcome_live >= e->outcome_max)
+		e->outcomes_cut = 1;
+}
+
+/*
+ * Count n steps of work, and stop searching once there are too many.
+ */
+static void
+spend(struct election_s *e, long long n)
+{
+	e->outcome_steps += n;
+	if (e->outcome_steps > e->outcome_steps_max)
+		e->outcomes_cut = 1;
+}
+
+/*
+ * Close the run's graph of components: row s of leads[] gets bit t
+ * set if a path leads from component s to component t.  Edges only go
+ * forward, so the rows are done from the last component back.
+ */
+static void
+run_leads(struct election_s *e, struct run_s *rp)
+{
+	int i, s, t, x, y;
+	int nl = rp->nl, ns = rp->nscc;
+	int *first, *list;
+	uint64_t *row;
+
+	rp->rw = (ns + 63) / 64;
+	rp->leads = temp_alloc(e, (size_t)ns * rp->rw, sizeof rp->leads[0]);
+	first = temp_alloc(e, ns + 1, sizeof first[0]);
+	list = temp_alloc(e, nl, sizeof list[0]);
+	for (x = 0; x < nl; x++)
+		first[rp->scc[x] + 1]++;
+	for (s = 0; s < ns; s++)
+		first[s + 1] += first[s];
+	for (x = 0; x < nl; x++)
+		list[first[rp->scc[x]]++] = x;
+	for (s = ns; s > 0; s--)
+		first[s] = first[s - 1];
+	first[0] = 0;
+
+	spend(e, (long long)nl * rp->lw);
+	for (s = ns - 1; s >= 0; s--) {
+		row = rp->leads + (size_t)s * rp->rw;
+		for (i = first[s]; i < first[s + 1]; i++) {
+			x = list[i];
+			for (y = next_bit(rp->beats + (size_t)x * rp->lw, 0, nl); y >= 0;
+			     y = next_bit(rp->beats + (size_t)x * rp->lw, y + 1, nl)) {
+				t = rp->scc[y];
+				if (t == s || TEST(row, t))
+					continue;
+				SET(row, t);
+				or_row(row, rp->leads + (size_t)t * rp->rw, rp->rw);
+				spend(e, rp->rw);
+			}
+		}
+	}
+	temp_free(e, first);
+	temp_free(e, list);
+}
+
+/*
+ * Lock m[0..k) in order into each frontier graph.
+ */
+static void
+lock_frontier(struct election_s *e, struct majority_s *m, int k)
+{
+	int f, i;
+
+	for (f = 0; f < e->num_frontier; f++) {
+		use_graph(e, e->frontier[f]);
+		for (i = 0; i < k; i++)
+			if (!path_to(e, m[i].c1, m[i].c2))
+				add_arc(e, m[i].c1, m[i].c2);
+	}
+}
+
+/*
+ * Place m[i] in the order being built, and count it off for the ones
+ * that must come after it.  Those that may now be placed go in ready[].
+ * Returns how many.
+ */
+static int
+place(struct election_s *e, struct tie_block_s *tb, int i, int *ready)
+{
+	int j, s, n;
+	uint64_t *after = BROW(tb->after, tb->scc[i]);
+
+	spend(e, tb->sw);
+	n = 0;
+	for (s = next_bit(after, 0, tb->ns); s >= 0; s = next_bit(after, s + 1, tb->ns))
+		if (--tb->wait[s] == 0)
+			for (j = tb->first[s]; j < tb->first[s + 1]; j++)
+				ready[n++] = tb->member[j];
+	return n;
+}
+
+/*
+ * Work out which majorities of the block must come before which, from
+ * the components of the run rp their losers are in.  loc[] is scratch,
+ * one for each component of the run, all -1; it is left that way.
+ */
+static void
+block_order(struct election_s *e, struct run_s *rp, struct tie_block_s *tb, int *loc)
+{
+	int i, s, t, w;
+	int *list;
+	uint64_t bits;
+	uint64_t *mask, *row, *after;
+
+	list = temp_alloc(e, tb->k, sizeof list[0]);
+	mask = temp_alloc(e, rp->rw, sizeof mask[0]);
+	tb->ns = 0;
+	for (i = 0; i < tb->k; i++) {
+		s = rp->scc[rp->slot[tb->m[i].c2]];
+		if (loc[s] < 0) {
+			loc[s] = tb->ns;
+			list[tb->ns++] = s;
+			SET(mask, s);
+		}
+		tb->scc[i] = loc[s];
+	}
+	tb->sw = (tb->ns + 63) / 64;
+	tb->after = temp_alloc(e, (size_t)tb->ns * tb->sw, sizeof tb->after[0]);
+	tb->first = temp_alloc(e, tb->ns + 1, sizeof tb->first[0]);
+	tb->waits = temp_alloc(e, tb->ns, sizeof tb->waits[0]);
+	tb->wait = temp_alloc(e, tb->ns, sizeof tb->wait[0]);
+	spend(e, (long long)tb->ns * rp->rw);
+	for (s = 0; s < tb->ns; s++) {
+		row = rp->leads + (size_t)list[s] * rp->rw;
+		after = BROW(tb->after, s);
+		for (w = 0; w < rp->rw; w++)
+			for (bits = row[w] & mask[w]; bits; bits &= bits - 1)
+				SET(after, loc[w * 64 + __builtin_ctzll(bits)]);
+	}
+
+	for (i = 0; i < tb->k; i++)
+		tb->first[tb->scc[i] + 1]++;
+	for (s = 0; s < tb->ns; s++)
+		tb->first[s + 1] += tb->first[s];
+	for (i = 0; i < tb->k; i++)
+		tb->member[tb->first[tb->scc[i]]++] = i;
+	for (s = tb->ns; s > 0; s--)
+		tb->first[s] = tb->first[s - 1];
+	tb->first[0] = 0;
+	for (s = 0; s < tb->ns; s++) {
+		after = BROW(tb->after, s);
+		for (t = next_bit(after, 0, tb->ns); t >= 0; t = next_bit(after, t + 1, tb->ns))
+			tb->waits[t] += tb->first[s + 1] - tb->first[s];
+	}
+
+	for (s = 0; s < tb->ns; s++)
+		loc[list[s]] = -1;
+	temp_free(e, list);
+	temp_free(e, mask);
+}
+
+/*
+ * Lock the block into the graph the reach bitsets are on, in the
+ * sorted order.
+ */
+static void
+lock_in_order(struct election_s *e, struct tie_block_s *tb)
+{
+	int i;
+	struct majority_s *m = tb->m;
+
+	for (i = 0; i < tb->k; i++)
+		if (!path_to(e, m[i].c1, m[i].c2))
+			add_arc(e, m[i].c1, m[i].c2);
+}
+
+/*
+ * Could m[i], left, still be blocked?  That is, can its loser reach its
+ * winner through g0 and the majorities locked or not yet decided that
+ * need not come after it?
+ */
+static int
+could_block(struct election_s *e, struct tie_block_s *tb, int i)
+{
+	int j, changed;
+	int nw = e->num_words;
+	uint64_t *set = e->block_scratch;
+	uint64_t *after = BROW(tb->after, tb->scc[i]);
+	struct majority_s *m = tb->m;
+
+	spend(e, nw);
+	memcpy(set, ROW(tb->g0, m[i].c2), nw * sizeof set[0]);
+	SET(set, m[i].c2);
+	do {
+		if (TEST(set, m[i].c1))
+			return 1;
+		spend(e, tb->k);
+		changed = 0;
+		for (j = 0; j < tb->k; j++)
+			if ((tb->state[j] == TIE_OPEN || tb->state[j] == TIE_LOCK) &&
+			    !TEST(after, tb->scc[j]) &&
+			    TEST(set, m[j].c1) && !TEST(set, m[j].c2)) {
+				or_row(set, ROW(tb->g0, m[j].c2), nw);
+				SET(set, m[j].c2);
+				changed = 1;
+			}
+	} while (changed);
+	return 0;
+}
+
+/*
+ * Is there an allowed order in which the block locks just the ones
+ * decided to lock?  Placing a locked one, or a left one that is blocked
+ * already, never spoils what can be placed later, so it is enough to
+ * place them as they come.  now[] holds those that can be placed, and
+ * later[] the left ones still waiting to be blocked.
+ */
+static int
+schedule(struct election_s *e, struct tie_block_s *tb)
+{
+	int i, j, n, placed;
+	int num_now, num_later;
+	int k = tb->k;
+	int *now = tb->todo, *later = tb->todo + k;
+	struct majority_s *m = tb->m;
+
+	spend(e, k + e->graph_words);
+	memcpy(e->order_scratch, tb->g0, e->graph_words * sizeof tb->g0[0]);
+	use_graph(e, e->order_scratch);
+	memcpy(tb->wait, tb->waits, tb->ns * sizeof tb->wait[0]);
+	num_now = num_later = 0;
+	for (i = 0; i < k; i++)
+		if (tb->wait[tb->scc[i]] == 0)
+			later[num_later++] = i;
+	placed = 0;
+	for (;;) {
+		for (j = n = 0; j < num_later; j++) {
+			i = later[j];
+			if (tb->state[i] == TIE_LOCK || path_to(e, m[i].c1, m[i].c2))
+				now[num_now++] = i;
+			else
+				later[n++] = i;
+		}
+		num_later = n;
+		if (num_now == 0)
+			break;
+		while (num_now > 0) {
+			i = now[--num_now];
+			if (tb->state[i] == TIE_LOCK)
+				add_arc(e, m[i].c1, m[i].c2);
+			num_later += place(e, tb, i, later + num_later);
+			placed++;
+		}
+	}
+	return placed == k;
+}
+
+/*
+ * The graph for a level of the search that has locked d majorities
+ * more than g0.  Only one such level is live at a time, so a graph is
+ * kept for each depth, and counted as kept.  Returns NULL, and cuts
+ * the search, if there is no room for it.
+ */
+static uint64_t *
+pool_graph(struct election_s *e, struct tie_block_s *tb, int d)
+{
+	if (d <= tb->num_pool)
+		return tb->pool[d - 1];
+	if (e->outcome_graphs + e->outcome_live + 1 >= e->outcome_max) {
+		e->outcomes_cut = 1;
+		return NULL;
+	}
+	tb->pool[tb->num_pool++] = temp_alloc(e, e->graph_words, sizeof tb->pool[0][0]);
+	e->outcome_live++;
+	return tb->pool[d - 1];
+}
+
+/*
+ * Decide each majority of the block in turn, on lock graph g0 and
+ * those decided to lock so far: lock it, if it closes no cycle, then
+ * leave it, if it and the others left can all still be blocked.  The
+ * graphs of the orders that work out go in e->next.  The levels are
+ * kept on a stack, not the C stack, since a block may be long.
+ */
+static void
+search_block(struct election_s *e, struct tie_block_s *tb)
+{
+	int f, i, j, d, sp;
+	uint64_t *g, *child;
+	struct majority_s *m = tb->m;
+
+	tb->at[0] = 0;
+	tb->depth[0] = 0;
+	tb->step[0] = SEARCH_ENTER;
+	sp = 1;
+	while (sp > 0) {
+		f = sp - 1;
+		i = tb->at[f];
+		d = tb->depth[f];
+		g = d ? tb->pool[d - 1] : tb->g0;
+
+		if (tb->step[f] == SEARCH_ENTER) {
+			if (e->outcomes_cut) {
+				sp--;
+				continue;
+			}
+			while (i < tb->k && tb->state[i] == TIE_BLOCKED)
+				i++;
+			tb->at[f] = i;
+			if (i == tb->k) {
+				if (schedule(e, tb)) {
+					tb->found = 1;
+					if (blob_add(e, &e->next, g))
+						count_graph(e);
+				}
+				sp--;
+				continue;
+			}
+			spend(e, 1);
+			tb->step[f] = SEARCH_LOCKED;
+			use_graph(e, g);
+			if (!path_to(e, m[i].c1, m[i].c2) &&
+			    (child = pool_graph(e, tb, d + 1))) {
+				spend(e, e->graph_words);
+				memcpy(child, g, e->graph_words * sizeof g[0]);
+				use_graph(e, child);
+				add_arc(e, m[i].c1, m[i].c2);
+				tb->state[i] = TIE_LOCK;
+				tb->at[sp] = i + 1;
+				tb->depth[sp] = d + 1;
+				tb->step[sp++] = SEARCH_ENTER;
+			}
+			continue;
+		}
+
+		if (tb->step[f] == SEARCH_LOCKED) {
+			tb->step[f] = SEARCH_LEFT;
+			tb->state[i] = TIE_LEAVE;
+			if (e->outcomes_cut)
+				continue;
+			for (j = 0; j <= i; j++)
+				if (tb->state[j] == TIE_LEAVE && !could_block(e, tb, j))
+					break;
+			if (j > i) {
+				tb->at[sp] = i + 1;
+				tb->depth[sp] = d;
+				tb->step[sp++] = SEARCH_ENTER;
+			}
+			continue;
+		}
+
+		tb->state[i] = TIE_OPEN;
+		sp--;
+	}
+}
+
+/*
+ * If every allowed order locks the block the same way into frontier
+ * graph f, or the search has been cut, lock it in place and return 1.
+ * Otherwise set the state of each majority for search_block(), and
+ * return 0.
+ */
+static int
+settle_block(struct election_s *e, struct tie_block_s *tb, int f)
+{
+	int j;
+	uint64_t *g;
+	struct majority_s *m = tb->m;
+
+	g = e->frontier[f];
+	use_graph(e, g);
+	if (e->outcomes_cut) {
+		lock_in_order(e, tb);
+		return 1;
+	}
+
+	// if the ones not blocked at the start lock whole, any order does.
+	spend(e, tb->k + e->graph_words);
+	for (j = 0; j < tb->k; j++)
+		tb->state[j] = path_to(e, m[j].c1, m[j].c2) ? TIE_BLOCKED : TIE_OPEN;
+	memcpy(e->next_scratch, g, e->graph_words * sizeof g[0]);
+	use_graph(e, e->next_scratch);
+	for (j = 0; j < tb->k; j++)
+		if (!path_to(e, m[j].c1, m[j].c2))
+			add_arc(e, m[j].c1, m[j].c2);
+		else if (tb->state[j] != TIE_BLOCKED)
+			return 0;
+	e->frontier[f] = e->next_scratch;
+	e->next_scratch = g;
+	return 1;
+}
+
+/*
+ * Add g with the block locked in order to e->next.
+ */
+static void
+next_in_order(struct election_s *e, struct tie_block_s *tb, uint64_t *g)
+{
+	memcpy(e->next_scratch, g, e->graph_words * sizeof g[0]);
+	use_graph(e, e->next_scratch);
+	lock_in_order(e, tb);
+	if (blob_add(e, &e->next, e->next_scratch))
+		count_graph(e);
+}
+
+/*
+ * Lock the tie block m[0..k) of the run rp into each frontier graph in
+ * each way an allowed order could.  Graphs stay in place until the
+ * first one that has to be searched.  From then on they all go to
+ * e->next, in order.  loc[] is scratch for block_order().
+ */
+static void
+tie_block(struct election_s *e, struct run_s *rp, struct majority_s *m, int k, int *loc)
+{
+	int f, j;
+	int merging;
+	struct tie_block_s tb;
+
+	tb.m = m;
+	tb.k = k;
+	tb.scc = temp_alloc(e, k, sizeof tb.scc[0]);
+	tb.member = temp_alloc(e, k, sizeof tb.member[0]);
+	tb.todo = temp_alloc(e, 2 * (size_t)k, sizeof tb.todo[0]);
+	tb.state = temp_alloc(e, k, sizeof tb.state[0]);
+	tb.at = temp_alloc(e, (size_t)k + 1, sizeof tb.at[0]);
+	tb.depth = temp_alloc(e, (size_t)k + 1, sizeof tb.depth[0]);
+	tb.step = temp_alloc(e, (size_t)k + 1, sizeof tb.step[0]);
+	tb.pool = temp_alloc(e, k, sizeof tb.pool[0]);
+	tb.num_pool = 0;
+	block_order(e, rp, &tb, loc);
+
+	merging = 0;
+	for (f = 0; f < e->num_frontier; f++) {
+		if (settle_block(e, &tb, f)) {
+			if (merging && blob_add(e, &e->next, e->frontier[f]))
+				count_graph(e);
+			continue;
+		}
+		if (!merging) {
+			for (j = 0; j < f; j++)
+				if (blob_add(e, &e->next, e->frontier[j]))
+					count_graph(e);
+			merging = 1;
+		}
+		tb.g0 = e->frontier[f];
+		tb.found = 0;
+		search_block(e, &tb);
+		// cut short before it found any: keep the sorted order.
+		if (!tb.found)
+			next_in_order(e, &tb, tb.g0);
+	}
+	temp_free(e, tb.scc);
+	temp_free(e, tb.member);
+	temp_free(e, tb.todo);
+	temp_free(e, tb.state);
+	temp_free(e, tb.after);
+	temp_free(e, tb.first);
+	temp_free(e, tb.waits);
+	temp_free(e, tb.wait);
+	temp_free(e, tb.at);
+	temp_free(e, tb.depth);
+	temp_free(e, tb.step);
+	for (j = 0; j < tb.num_pool; j++)
+		temp_free(e, tb.pool[j]);
+	temp_free(e, tb.pool);
+	e->outcome_live -= tb.num_pool;
+	if (merging)
+		next_frontier(e);
+}
+
+/*
+ * Lock the run m[0..k) of equal strength majorities into the frontier
+ * graphs.  It is cut into tie blocks after each majority where every
+ * component still to come is one that all the block's lead to.
+ */
+static void
+tie_run(struct election_s *e, struct majority_s *m, int k, int *slot)
+{
+	int i, s, w, start;
+	int *rem, *loc;
+	uint64_t *all, *left, *row;
+	struct run_s run;
+
+	run_open(e, &run, m, k, slot);
+	spend(e, (long long)run.nl * run.nl);
+	run_leads(e, &run);
+	if (e->outcomes_cut) {
+		lock_frontier(e, m, k);
+		run_close(e, &run);
+		return;
+	}
+	rem = temp_alloc(e, run.nscc, sizeof rem[0]);
+	loc = temp_alloc(e, run.nscc, sizeof loc[0]);
+	all = temp_alloc(e, run.rw, sizeof all[0]);
+	left = temp_alloc(e, run.rw, sizeof left[0]);
+	for (s = 0; s < run.nscc; s++)
+		loc[s] = -1;
+	for (i = 0; i < k; i++) {
+		s = LOSER_SCC(&run, i);
+		if (rem[s]++ == 0)
+			SET(left, s);
+	}
+
+	spend(e, (long long)k * run.rw);
+	memset(all, 0xff, run.rw * sizeof all[0]);
+	for (i = start = 0; i < k; i++) {
+		s = LOSER_SCC(&run, i);
+		if (--rem[s] == 0)
+			CLEAR(left, s);
+		row = run.leads + (size_t)s * run.rw;
+		for (w = 0; w < run.rw; w++)
+			all[w] &= row[w];
+		for (w = 0; w < run.rw && !(left[w] & ~all[w]); w++)
+			;
+		if (w < run.rw)
+			continue;
+		if (i == start)
+			lock_frontier(e, m + i, 1);
+		else
+			tie_block(e, &run, m + start, i + 1 - start, loc);
+		start = i + 1;
+		memset(all, 0xff, run.rw * sizeof all[0]);
+	}
+	temp_free(e, rem);
+	temp_free(e, loc);
+	temp_free(e, all);
+	temp_free(e, left);
+	run_close(e, &run);
+}
+
+/*
+ * Peel the lock graph g into layers, as find_rp_winners() does, and
+ * set rank[c] for each active candidate c, -1 for the others.
+ * left and tier are scratch, num_words and num_candidates long.
+ */
+static void
+layer_ranking(struct election_s *e, uint64_t *g, int *rank, uint64_t *left, int *tier)
+{
+	int c, i, w;
+	int count, remaining, next;
+	int nw = e->num_words;
+	uint64_t *row;
+
+	use_graph(e, g);
+	memset(left, 0, nw * sizeof left[0]);
+	remaining = 0;
+	for (c = 0; c < e->num_candidates; c++) {
+		rank[c] = -1;
+		if (e->active[c]) {
+			SET(left, c);
+			remaining++;
+		}
+	}
+	next = e->next_winner;
+	while (remaining) {
+		count = 0;
+		for (c = 0; c < e->num_candidates; c++) {
+			if (!TEST(left, c))
+				continue;
+			row = ROW(e->reached_by, c);
+			for (w = 0; w < nw && !(row[w] & left[w]); w++)
+				;
+			if (w == nw)
+				tier[count++] = c;
+		}
+		for (i = 0; i < count; i++) {
+			CLEAR(left, tier[i]);
+			rank[tier[i]] = next;
+		}
+		next += count;
+		remaining -= count;
+	}
+}
+
+/*
+ * Add the ranking the lock graph g gives to e->outcomes, unless it is
+ * there already.  rank, left and tier are scratch for layer_ranking().
+ */
+static void
+add_outcome(struct election_s *e, uint64_t *g, int *rank, uint64_t *left, int *tier)
+{
+	int nc = e->num_candidates;
+
+	layer_ranking(e, g, rank, left, tier);
+	if (!blob_add(e, &e->next, rank))
+		return;
+	e->outcomes = grow(e, e->outcomes, &e->outcomes_alloc,
+		(e->num_outcomes + 1) * nc, sizeof e->outcomes[0]);
+	memcpy(e->outcomes + (size_t)e->num_outcomes * nc, rank, nc * sizeof rank[0]);
+	e->num_outcomes++;
+}
+
+/*
+ * Find every ranking of the active candidates that some order of the
+ * tied majorities gives.  Called between do_sort() and do_lock().
+ */
+static void
+find_outcomes(struct election_s *e)
+{
+	int i, end, f, nc;
+	int *slot;
+	uint64_t *save_reach, *save_reached_by, *save_scratch;
+	uint64_t *g, *left;
+	int *rank, *tier;
+	struct majority_s *m;
+
+	live_majorities(e);
+	nc = e->num_candidates;
+	m = e->majorities;
+	save_reach = e->reach;
+	save_reached_by = e->reached_by;
+	save_scratch = e->reach_scratch;
+	e->searching = 1;
+	e->num_words = (nc + 63) / 64;
+	e->graph_words = 2 * (size_t)nc * e->num_words;
+	e->reach_scratch = zalloc(e, 2 * e->num_words, sizeof e->reach_scratch[0]);
+	e->block_scratch = zalloc(e, e->num_words, sizeof e->block_scratch[0]);
+	e->next_scratch = zalloc(e, e->graph_words, sizeof e->next_scratch[0]);
+	e->order_scratch = zalloc(e, e->graph_words, sizeof e->order_scratch[0]);
+	e->next.len = e->graph_words * sizeof g[0];
+	e->outcome_max = (long long)e->outcome_limit * 1024 / e->next.len;
+	if (e->outcome_max < 1)
+		e->outcome_max = 1;
+	e->outcome_steps_max = (long long)e->outcome_limit * 1024 * OUTCOME_STEPS;
+
+	g = temp_alloc(e, e->graph_words, sizeof g[0]);
+	blob_add(e, &e->next, g);
+	temp_free(e, g);
+	next_frontier(e);
+
+	slot = temp_alloc(e, nc, sizeof slot[0]);
+	for (i = 0; i < nc; i++)
+		slot[i] = -1;
+	for (i = 0; i < e->num_majorities; i = end) {
+		for (end = i + 1; end < e->num_majorities &&
+		     m[end].strength == m[i].strength; end++)
+			;
+		if (end - i > 1 && !e->outcomes_cut)
+			tie_run(e, m + i, end - i, slot);
+		else
+			lock_frontier(e, m + i, end - i);
+	}
+	temp_free(e, slot);
+
+	// the distinct rankings, the sorted order's first.
+	e->next.len = nc * sizeof rank[0];
+	rank = temp_alloc(e, nc, sizeof rank[0]);
+	tier = temp_alloc(e, nc, sizeof tier[0]);
+	left = temp_alloc(e, e->num_words, sizeof left[0]);
+	g = e->order_scratch;
+	memset(g, 0, e->graph_words * sizeof g[0]);
+	use_graph(e, g);
+	for (i = 0; i < e->num_majorities; i++)
+		if (!path_to(e, m[i].c1, m[i].c2))
+			add_arc(e, m[i].c1, m[i].c2);
+	add_outcome(e, g, rank, left, tier);
+	for (f = 0; f < e->num_frontier; f++)
+		add_outcome(e, e->frontier[f], rank, left, tier);
+	temp_free(e, rank);
+	temp_free(e, tier);
+	temp_free(e, left);
+	blob_clear(&e->next);
+	free_frontier(e);
+
+	free(e->reach_scratch);
+	free(e->block_scratch);
+	free(e->next_scratch);
+	free(e->order_scratch);
+	e->block_scratch = e->next_scratch = e->order_scratch = NULL;
+	e->reach = save_reach;
+	e->reached_by = save_reached_by;
+	e->reach_scratch = save_scratch;
+	e->searching = 0;
+}
+
+/*
+ * The candidates ranked before the sort have the same rank in every
+ * outcome.  With no majorities left to sort there is just the one.
+ */
+static void
+finish_outcomes(struct election_s *e)
+{
+	int i, c;
+	int nc = e->num_candidates;
+
+	if (!e->num_outcomes) {
+		e->outcomes = grow(e, e->outcomes, &e->outcomes_alloc, nc,
+			sizeof e->outcomes[0]);
+		for (c = 0; c < nc; c++)
+			e->outcomes[c] = -1;
+		e->num_outcomes = 1;
+	}
+	for (i = 0; i < e->num_outcomes; i++)
+		for (c = 0; c < nc; c++)
+			if (e->outcomes[(size_t)i * nc + c] < 0)
+				e->outcomes[(size_t)i * nc + c] = e->candidates[c].ranking;
+}
+
+/*
+ * Debugging routine.
+ */
+static void
+print_majorities(struct election_s *e)
+{
+	int i;
+	struct majority_s *mp;
+
+	live_majorities(e);
+	fprintf(e->log, "Majorities\n");
+	for (i = 0, mp = e->majorities; i < e->num_majorities; i++, mp++)
+		fprintf(e->log, "\t%10s > %10s strength %3d\n",
+			e->candidates[mp->c1].name,
+			e->candidates[mp->c2].name,
+			mp->strength);
+	fprintf(e->log, "\n");
+}
+
+/*
+ * Rank the candidates from the pairwise matrix.
+ */
+static void
+rank_pairwise(struct election_s *e)
+{
+	int locked;
+
+	e->next_winner = 0;
+	e->next_loser = e->num_candidates - 1;
+
+	create_majorities(e);
+	stage(e, "majorities");
+	if (e->debug) {
+		check_majorities(e, "after creating them");
+		if (e->debug > 1)
+			print_majorities(e);
+	}
+	e->ranking_phase = 0;
+	pull_unranked_losers(e);
+	while (pull_condorcet(e))
+		;
+	stage(e, "condorcet");
+	if (e->verbose) {
+		fprintf(e->log, "%d majorities and %lld majority pairings remain.  %lld majority ties were found.\n",
+			e->num_majorities,
+			(long long)e->num_majorities * (e->num_majorities - 1) / 2,
+			count_tied_majorities(e));
+		stage(e, "count_ties");
+	}
+	e->ranking_tie = 0;
+	if (e->num_majorities) {
+		do_sort(e);
+		stage(e, "sort");
+		if (e->outcome_limit) {
+			find_outcomes(e);
+			stage(e, "outcomes");
+		}
+		locked = do_lock(e);
+		stage(e, "lock");
+		find_rp_winners(e, locked);
+		stage(e, "rp_winners");
+	}
+	finish_rankings(e);
+	if (e->outcome_limit)
+		finish_outcomes(e);
+}
+
+/*
+ * Count what is left of the ballots, then rank the candidates.
+ */
+int
+election_rank(struct election_s *e)
+{
+	ENTER(e);
+	if (e->ranked)
+		return reject(e, "the election has already been ranked");
+	e->ranked = 1;
+	start_tally(e);
+	tally_ballots(e);
+	rank_pairwise(e);
+	return 0;
+}
+
+int
+election_result(struct election_s *e, int c, struct election_result_s *rp)
+{
+	struct candidate_s *cp;
+
+	ENTER(e);
+	if (!e->ranked)
+		return reject(e, "the election has not been ranked");
+	if (c < 0 || c >= e->num_candidates)
+		return reject(e, "there is no candidate %d", c);
+	cp = &e->candidates[c];
+	rp->rank = cp->ranking + 1;
+	rp->phase = cp->ranking_phase + 1;
+	rp->source = cp->ranking_source;
+	rp->tied = e->ranking_tie_phase >= 0 && cp->ranking_phase >= e->ranking_tie_phase;
+	return 0;
+}
+
+/*
+ * Is the ranking one of several that ranked pairs could give?
+ */
+int
+election_tied(struct election_s *e)
+{
+	return e->ranking_tie;
+}
+
+void
+election_set_outcomes(struct election_s *e, int limit)
+{
+	e->outcome_limit = limit < 1 ? 1 : limit;
+}
+
+int
+election_num_outcomes(struct election_s *e)
+{
+	return e->num_outcomes;
+}
+
+/*
+ * Set rank[c] to candidate c's rank in outcome k, counting outcomes
+ * from 0 and ranks from 1.
+ */
+int
+election_outcome(struct election_s *e, int k, int *rank)
+{
+	int c;
+
+	ENTER(e);
+	if (!e->ranked)
+		return reject(e, "the election has not been ranked");
+	if (k < 0 || k >= e->num_outcomes)
+		return reject(e, "there is no outcome %d", k);
+	for (c = 0; c < e->num_candidates; c++)
+		rank[c] = e->outcomes[(size_t)k * e->num_candidates + c] + 1;
+	return 0;
+}
+
+int
+election_outcomes_cut(struct election_s *e)
+{
+	return e->outcomes_cut;
+}
+
+const char *
+election_source_name(int source)
+{
+	if (source < 0 || source > RANKING_NONE)
+		return ranking_source_names[0];
+	return ranking_source_names[source];
+}
+
+/*
+ * Sort the candidates and print them out.
+ */
+static int
+rank_order(const void *p, const void *q)
+{
+	const struct candidate_s *cp = p;
+	const struct candidate_s *cq = q;
+
+	return cp->ranking - cq->ranking;
+}
+
+int
+election_print(struct election_s *e, FILE *fp)
+{
+	int i;
+	char flag;
+	struct candidate_s *sorted, *cp;
+
+	ENTER(e);
+	if (!e->ranked)
+		return reject(e, "the election has not been ranked");
+	sorted = zalloc(e, e->num_candidates, sizeof sorted[0]);
+	memcpy(sorted, e->candidates, e->num_candidates * sizeof sorted[0]);
+	qsort(sorted, e->num_candidates, sizeof sorted[0], rank_order);
+
+	if (e->ranking_tie)
+		fprintf(fp, "Ranking ties were found.  RP ranking is not unique.\n");
+	fprintf(fp, "\n Name     Rank Phase Ranking Source\n");
+	for (i = 0, cp = sorted; i < e->num_candidates; i++, cp++) {
+		flag = ' ';
+		if (e->ranking_tie_phase >= 0 && cp->ranking_phase >= e->ranking_tie_phase)
+			flag = '*';
+		fprintf(fp, "%10s %3d%c %4d  %s\n",
+			cp->name,
+			cp->ranking + 1,
+			flag,
+			cp->ranking_phase + 1,
+			ranking_source_names[cp->ranking_source]);
+	}
+	free(sorted);
+	return 0;
+}
+
+/*
+ * Bootstrap.
+ * Each resample counts the kept ballots again with every voter's
+ * weight redrawn from a Poisson distribution with mean 1, so a ballot
+ * cast by w voters counts Poisson(w) times.  That is the Poisson
+ * bootstrap: it stands in for drawing the voters with replacement,
+ * but every ballot's weight can be drawn on its own.  The ranking is
+ * then done again from the new pairwise matrix.
+ */
+
+/*
+ * splitmix64, as in gen.c.
+ */
+static uint64_t
+rand64(uint64_t *sp)
+{
+	uint64_t z;
+
+	z = (*sp += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*
+ * A number in [0, 1).
+ */
+static double
+rand_unit(uint64_t *sp)
+{
+	return (rand64(sp) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * log(k!), by Stirling's series past the first few.
+ */
+static double
+log_factorial(long k)
+{
+	double x, f;
+
+	if (k < 10) {
+		for (f = 0; k > 1; k--)
+			f += log((double)k);
+		return f;
+	}
+	x = k + 1;
+	return (x - 0.5) * log(x) - x + 0.91893853320467274178 +
+		(1 / 12.0 - (1 / 360.0 - 1 / (1260.0 * x * x)) / (x * x)) / x;
+}
+
+/*
+ * exp(-m), the chance of a Poisson deviate with small mean m being 0.
+ */
+static const double poisson_zero[10] = {
+	1,
+	0.36787944117144233,
+	0.1353352832366127,
+	0.049787068367863944,
+	0.018315638888734179,
+	0.006737946999085467,
+	0.0024787521766663585,
+	0.00091188196555451624,
+	0.00033546262790251185,
+	0.00012340980408667956,
+};
+
+/*
+ * A Poisson deviate with mean m.  Small means, which are most ballots,
+ * are found by walking the distribution with one uniform; larger ones
+ * use Hormann's transformed rejection (PTRS).
+ */
+static int
+poisson(uint64_t *sp, int m)
+{
+	long k;
+	double lam, p;
+	double slam, loglam, a, b, invalpha, vr, u, v, us;
+
+	lam = m;
+	if (m < 10) {
+		u = rand_unit(sp);
+		p = poisson_zero[m];
+		for (k = 0; u >= p && p > 0; k++) {
+			u -= p;
+			p *= lam / (k + 1);
+		}
+		return k;
+	}
+	slam = sqrt(lam);
+	loglam = log(lam);
+	b = 0.931 + 2.53 * slam;
+	a = -0.059 + 0.02483 * b;
+	invalpha = 1.1239 + 1.1328 / (b - 3.4);
+	vr = 0.9277 - 3.6224 / (b - 2);
+	for (;;) {
+		u = rand_unit(sp) - 0.5;
+		v = rand_unit(sp);
+		us = 0.5 - fabs(u);
+		k = (long)floor((2 * a / us + b) * u + lam + 0.43);
+		if (us >= 0.07 && v <= vr)
+			return k;
+		if (k < 0 || (us < 0.013 && v > us))
+			continue;
+		if (log(v) + log(invalpha) - log(a / (us * us) + b) <=
+		    -lam + k * loglam - log_factorial(k))
+			return k;
+	}
+}
+
+struct boot_s {
+	struct election_s *e;
+	pthread_t tid;
+	int thread;	// tid is a thread to join
+	int failed;
+	int first;	// does resamples first, first + step, ...
+	int step;
+	int resamples;
+	uint64_t seed;
+	int *place;	// place[c * num_candidates + k]: times c came in place k
+};
+
+static void
+free_scratch(struct election_s *s)
+{
+	if (!s)
+		return;
+	free(s->candidates);
+	free(s->pairwise);
+	free(s->mentions);
+	free(s->majorities);
+	free(s->active);
+	free(s->reach);
+	free(s->reached_by);
+	free(s->reach_scratch);
+	free(s->temps);
+	free(s);
+}
+
+/*
+ * Run some of the resamples.  Each thread ranks them in a scratch
+ * election of its own, which borrows the candidate names.  Each
+ * resample draws from its own seed, so the counts do not depend on
+ * how the resamples are split among the threads.
+ */
+static void *
+boot_range(void *arg)
+{
+	struct boot_s *bp = arg;
+	struct election_s *e = bp->e;
+	struct election_s *s;
+	int nc = e->num_candidates;
+	int i, j, n, r, w;
+	int *rank;
+	int *list;
+	int *pairs;
+	uint64_t state;
+
+	s = calloc(1, sizeof *s);
+	rank = calloc(nc + 1, sizeof rank[0]);
+	list = calloc(nc + 1, sizeof list[0]);
+	if (s) {
+		s->candidates = calloc(nc + 1, sizeof s->candidates[0]);
+		s->pairwise = calloc((size_t)nc * nc + 1, sizeof s->pairwise[0]);
+		s->mentions = calloc(nc + 1, sizeof s->mentions[0]);
+	}
+	if (!s || !rank || !list || !s->candidates || !s->pairwise || !s->mentions) {
+		bp->failed = 1;
+		goto out;
+	}
+	s->num_candidates = nc;
+	s->num_threads = 1;
+	s->log = e->log;
+	if (setjmp(s->env)) {
+		bp->failed = 1;
+		goto out;
+	}
+
+	for (i = 0; i < nc; i++)
+		rank[i] = UNRANKED;
+	for (r = bp->first; r < bp->resamples; r += bp->step) {
+		state = bp->seed + r;
+		state = rand64(&state);
+		memset(s->pairwise, 0, (size_t)nc * nc * sizeof s->pairwise[0]);
+		memset(s->mentions, 0, nc * sizeof s->mentions[0]);
+		for (i = 0; i < e->num_kept; i++) {
+			w = poisson(&state, e->kept[i].weight);
+			if (!w)
+				continue;
+			n = e->kept[i].n;
+			pairs = e->kept_pool + e->kept[i].off;
+			for (j = 0; j < n; j++) {
+				list[j] = pairs[2 * j];
+				rank[list[j]] = pairs[2 * j + 1];
+			}
+			tally_ballot(s->pairwise, s->mentions, rank, list, n, w, nc);
+			for (j = 0; j < n; j++)
+				rank[list[j]] = UNRANKED;
+		}
+
+		memset(s->candidates, 0, nc * sizeof s->candidates[0]);
+		for (i = 0; i < nc; i++)
+			s->candidates[i].name = e->candidates[i].name;
+		free(s->majorities);
+		free(s->active);
+		s->majorities = NULL;
+		s->active = NULL;
+		rank_pairwise(s);
+		for (i = 0; i < nc; i++)
+			bp->place[(size_t)i * nc + s->candidates[i].ranking]++;
+	}
+
+out:
+	free_scratch(s);
+	free(rank);
+	free(list);
+	return NULL;
+}
+
+/*
+ * Rank resamples of the kept ballots on num_threads threads.
+ * place[c * num_candidates + k] is set to the number of resamples in
+ * which candidate c came in place k + 1.
+ */
+int
+election_bootstrap(struct election_s *e, int resamples, unsigned long long seed, int *place)
+{
+	int t, nt;
+	int failed;
+	size_t i, size;
+	struct boot_s *boot;
+
+	ENTER(e);
+	if (!e->keep)
+		return reject(e, "the ballots were not kept for a bootstrap");
+	if (resamples < 1)
+		return reject(e, "bad number of resamples (%d)", resamples);
+	start_tally(e);
+	tally_ballots(e);
+
+	nt = e->num_threads;
+	if (nt > resamples)
+		nt = resamples;
+	boot = zalloc(e, nt, sizeof boot[0]);
+	size = (size_t)e->num_candidates * e->num_candidates;
+	for (t = 0; t < nt; t++) {
+		boot[t].e = e;
+		boot[t].first = t;
+		boot[t].step = nt;
+		boot[t].resamples = resamples;
+		boot[t].seed = seed;
+		boot[t].place = calloc(size + 1, sizeof place[0]);
+		if (!boot[t].place)
+			boot[t].failed = 1;
+		else if (t == 0)
+			continue;
+		else if (pthread_create(&boot[t].tid, NULL, boot_range, &boot[t]) == 0)
+			boot[t].thread = 1;
+		else
+			boot_range(&boot[t]);
+	}
+	if (!boot[0].failed)
+		boot_range(&boot[0]);
+
+	memset(place, 0, size * sizeof place[0]);
+	failed = 0;
+	for (t = 0; t < nt; t++) {
+		if (boot[t].thread)
+			pthread_join(boot[t].tid, NULL);
+		failed |= boot[t].failed;
+		for (i = 0; !failed && i < size; i++)
+			place[i] += boot[t].place[i];
+		free(boot[t].place);
+	}
+	free(boot);
+	if (failed)
+		fail(e, "out of memory");
+	return 0;
+}
@@ -10,16 +10,7 @@
  * voters list.
  *
  * Input is stdin, output is stdout.
- */
-
-/*
-
-
-NOTE: Haven't dealt with tied rankings yet.  For now,
-this produces a ranking, not all rankings.  Which ranking
-depends on whatever qsort happens to do
-
-
+ * This is the command; the counting is done by libranked (ranked.h).
  */
 
 #include <stdio.h>
@@ -27,205 +18,665 @@ depends on whatever qsort happens to do
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
-#define	MAX_CANDIDATES	50
-#define	MAX_VOTERS	10
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "ranked.h"
 
 int verbose;
 int debug;
 int numeric_mode;
+int line_mode;
+int num_threads;
+int weighted_mode;
+int timing;
+int merge_mode;
+char *compile_file;
+char *compiled_input;
+char **merge_files;
+int num_merge_files;
+char *partial_file;
+char *batch_list;
+int resamples;
+unsigned long long boot_seed;
+int all_outcomes;
+int sparse_mode;
 
 /*
- * Record string name of each candidate.
+ * How much memory, in kilobytes, -a may spend on lock graphs while it
+ * looks for tied outcomes.  Each is about candidates * candidates / 4
+ * bytes, so this bounds the search more tightly for big elections.
  */
-#define	RANKING_C_WINNER	1
-#define	RANKING_C_LOSER		2
-#define	RANKING_T_WINNER	3
-#define	RANKING_T_LOSER		4
-#define	RANKING_LOSER		5
-#define	RANKING_NONE		6
-
-char *ranking_source_names[] = {
-	"NULL",
-	"Condorcet Winner",
-	"Condorcet Loser",
-	"Ranked Pairs Winner",
-	"Ranked Pairs Loser",
-	"No Rankings",
-	"No Algorithm",
-};
+#define	OUTCOME_KBYTES	(16 * 1024)
+
+/*
+ * Everything below about the input being counted is kept per thread,
+ * so that batch mode (-B) can count several inputs at once.
+ */
+
+/*
+ * Where the output and messages go: stdout and stderr, except in
+ * batch mode, where each input's are kept until it is its turn.
+ * bail() stops on bad input: it exits, or in batch mode gives up on
+ * the input and goes on to the next.
+ */
+__thread FILE *outfp;
+__thread FILE *errfp;
+static __thread jmp_buf *bail_env;
+
+/*
+ * The election being counted.
+ */
+__thread struct election_s *election;
 
-int num_candidates;
-int next_winner;
-int next_loser;
-struct candidate_s {
-	char *name;
-	int ranking;
-	int ranking_phase;
-	int ranking_source;
-	int wins_pair;
-	int loses_pair;
-	int ties;
-} candidates[MAX_CANDIDATES];
-
-int ranking_phase;
-int ranking_tie;
+/*
+ * In column mode, names[i] is the name in the first column of row i,
+ * or NULL if it is blank.  The candidates are the rows up to the first
+ * blank one.  Otherwise the names are only kept in the election.
+ */
+__thread int num_candidates;
+__thread char **names;
+__thread int names_alloc;
 
 /*
- * rankings[i][j] records rank voter i gave to candidate j.
+ * rankings records the rank voter i gave to candidate j;
+ * use get_rank(i, j) and set_rank(i, j, r).
  * If no ranking given, then it is zero.
  * Best candidate gets a 1, next is 2, etc.
+ * Ranks never exceed num_candidates, so each one is stored in the
+ * fewest bytes that will hold that: rank_width is 1, 2 or 4.
+ * One voter's ranks are together, since ballots are tallied a voter at a time.
+ */
+__thread int num_voters;
+__thread int *num_rankings;
+__thread int rank_width;
+__thread void *rankings;
+
+/*
+ * In weighted mode (-w), voter_weight[i] is the number of voters who
+ * cast the ballot in column i.  Otherwise it is not used.
+ */
+__thread int *voter_weight;
+__thread int voter_weight_alloc;
+
+/*
+ * With -i, rankings[] and voter_weight[] point into the compiled file,
+ * mapped at compiled_map.  They are unmapped with it, never freed.
+ */
+__thread char *compiled_map;
+__thread size_t compiled_len;
+
+/*
+ * A field of the input file.  Points straight into the input buffer,
+ * and is not nul terminated.
+ */
+struct field_s {
+	char *p;
+	int len;
+};
+
+/*
+ * Input reader.  Hands out the input one line at a time, split into fields.
+ * A regular file is mapped whole.  Anything else (a pipe) is read in large
+ * blocks, or read whole if the caller needs the fields to stay put.
  */
-int num_voters;
-int num_rankings[MAX_VOTERS];
-int rankings[MAX_VOTERS][MAX_CANDIDATES];
+#define	READ_BLOCK	(1 << 20)
+struct reader_s {
+	int fd;
+	char *buf;
+	size_t len;	// bytes of input in buf
+	size_t pos;	// start of the next line
+	size_t alloc;	// size of buf, if not mapped
+	int mapped;
+	int eof;
+	int lineno;
+	int nf;		// fields on the current line
+	int falloc;
+	struct field_s *f;
+};
 
 /*
- * sr[i][j] contains the candidate index of the candidate
+ * sr[j] is row j of the input file, less the candidate name.
+ * sr[j].v[i] contains the name of the candidate
  * that voter i ranked in position j, zero indexed.
+ * Cells past the end of a row are missing, same as empty cells.
  */
-char *sr[MAX_VOTERS][MAX_CANDIDATES];
+__thread int num_rows;
+__thread int num_columns;
+__thread struct row_s {
+	int n;
+	struct field_s *v;
+} *sr;
+__thread int sr_alloc;
 
 /*
- * Majorities.
- * Who ranks higher than who?  One for each possible pair.
+ * The input file.  Column mode keeps pointers into it until it is done.
  */
-int num_majorities;
-struct majority_s {
-	int c1;		// winner, if strength > 0.  Most of the code is normalized so c1 wins.
-	int c2;		// winner, if strength < 0
-	int strength;
-	int locked;
-	int flag;
-} majorities[MAX_CANDIDATES * MAX_CANDIDATES];
+__thread struct reader_s reader;
 
 char *myname;
 
+static void
+bail()
+{
+	if (bail_env)
+		longjmp(*bail_env, 1);
+	exit(1);
+}
+
+/*
+ * Make sure the array at p has room for at least n elements of the given size.
+ * *alloc is the number of elements currently allocated; it is updated.
+ * Returns the (possibly moved) array.
+ */
+static void *
+grow(void *p, int *alloc, int n, size_t size)
+{
+	int a;
+
+	if (n <= *alloc)
+		return p;
+	a = *alloc ? *alloc : 16;
+	while (a < n)
+		a *= 2;
+	p = realloc(p, (size_t)a * size);
+	if (!p) {
+		fprintf(errfp, "%s: out of memory\n", myname);
+		bail();
+	}
+	memset((char *)p + (size_t)*alloc * size, 0, (size_t)(a - *alloc) * size);
+	*alloc = a;
+	return p;
+}
+
+/*
+ * Allocate zeroed memory for n elements of the given size.
+ */
+static void *
+zalloc(size_t n, size_t size)
+{
+	void *p;
+
+	p = calloc(n ? n : 1, size);
+	if (!p) {
+		fprintf(errfp, "%s: out of memory\n", myname);
+		bail();
+	}
+	return p;
+}
+
+/*
+ * Stage timing and counts (-T).
+ * stage(name) reports with the messages how long the stage just finished
+ * took, and the peak memory use of the whole process so far, as
+ *	stage<TAB>name<TAB>seconds<TAB>peak kbytes
+ * and starts timing the next one.  stage(NULL) just starts the clock.
+ * The election counts its hot calls all the time, since that is cheap,
+ * and print_counts() reports them as
+ *	count<TAB>name<TAB>calls
+ */
+static __thread struct timespec stage_time;
+static __thread struct timespec start_time;
+
+static long
+peak_kbytes()
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return -1;
+	return ru.ru_maxrss;
+}
+
+static double
+since(struct timespec *tp)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - tp->tv_sec) + (now.tv_nsec - tp->tv_nsec) / 1e9;
+}
+
+static void
+stage(const char *name)
+{
+	if (!timing)
+		return;
+	if (!name)
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+	else
+		fprintf(errfp, "stage\t%s\t%.6f\t%ld\n", name, since(&stage_time),
+			peak_kbytes());
+	clock_gettime(CLOCK_MONOTONIC, &stage_time);
+}
+
+/*
+ * The election calls this as each of its stages finishes.
+ */
+static void
+stage_hook(void *arg, const char *name)
+{
+	(void)arg;
+	stage(name);
+}
+
+static void
+print_counts()
+{
+	struct election_counts_s counts;
+
+	election_counts(election, &counts);
+	fprintf(errfp, "count\tname_compares\t%lld\n", counts.name_compares);
+	fprintf(errfp, "count\tcompar\t%lld\n", counts.compar);
+	fprintf(errfp, "count\tpath_to\t%lld\n", counts.path_to);
+	fprintf(errfp, "count\tarc_rows\t%lld\n", counts.arc_rows);
+	fprintf(errfp, "count\tremove_pairings\t%lld\n", counts.remove_pairings);
+	fprintf(errfp, "count\tcompactions\t%lld\n", counts.compactions);
+}
+
+/*
+ * Check the result of a libranked call.  It only fails on something
+ * that would stop the count, so say what and exit.
+ */
+static int
+check(int r)
+{
+	if (r < 0) {
+		fprintf(errfp, "%s: %s\n", myname, election_error(election));
+		bail();
+	}
+	return r;
+}
+
+/*
+ * Return the cell voter i filled in on row j, or NULL if it is empty.
+ */
+static struct field_s *
+cell(int i, int j)
+{
+	if (j >= num_rows || i >= sr[j].n || !sr[j].v[i].len)
+		return NULL;
+	return &sr[j].v[i];
+}
+
 /*
- * Copy a string into the malloc heap.
+ * Copy a field into the malloc heap as a string.
  * Return a pointer to it.
  */
 static char *
-dscopy(char *p)
+dscopy(struct field_s *fp)
 {
 	char *r;
-	size_t n;
 
-	n = strlen(p) + 1;
-	r = malloc(n);
-
-	memcpy(r, p, n);
+	r = zalloc(fp->len + 1, 1);
+	memcpy(r, fp->p, fp->len);
 	return r;
 }
 
 /*
- * Parse a field from a csv line.
+ * Start reading the file open on fd.
+ * If whole is set, fields handed out stay valid until the program exits.
+ * Otherwise they are only good until the next call to read_line().
  */
-static char *
-parsecsvf(char *p, char **r)
+static void
+reader_open(struct reader_s *rp, int fd, int whole)
 {
-	int i;
-	char *q;
-	char lbuf[128];
-
-	q = lbuf;
-	for (i = 0; i < sizeof lbuf; i++) {
-		// skip over some characters.
-		while (*p == '\r' || *p == '\n')
-			p++;
-
-		// end of field, with more to come.
-		if (*p == ',') {
-			p++;
-			break;
+	struct stat st;
+	ssize_t n;
+
+	memset(rp, 0, sizeof *rp);
+	rp->fd = fd;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		rp->buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (rp->buf != MAP_FAILED) {
+			madvise(rp->buf, st.st_size, MADV_SEQUENTIAL);
+			rp->len = st.st_size;
+			rp->mapped = 1;
+			rp->eof = 1;
+			return;
 		}
+		rp->buf = NULL;
+	}
 
-		// end of field, no more to come
-		if (*p == '\0')
+	rp->alloc = READ_BLOCK;
+	rp->buf = zalloc(rp->alloc, 1);
+	if (!whole)
+		return;
+	for (;;) {
+		if (rp->len == rp->alloc) {
+			rp->alloc *= 2;
+			rp->buf = realloc(rp->buf, rp->alloc);
+			if (!rp->buf) {
+				fprintf(errfp, "%s: out of memory\n", myname);
+				bail();
+			}
+		}
+		n = read(fd, rp->buf + rp->len, rp->alloc - rp->len);
+		if (n < 0) {
+			fprintf(errfp, "%s: %s\n", myname, strerror(errno));
+			bail();
+		}
+		if (n == 0)
 			break;
+		rp->len += n;
+	}
+	rp->eof = 1;
+}
+
+/*
+ * Read more input into the buffer, keeping the unfinished line.
+ * Returns 0 at end of file.
+ */
+static int
+reader_fill(struct reader_s *rp)
+{
+	ssize_t n;
 
-		*q++ = *p++;
+	if (rp->eof)
+		return 0;
+	memmove(rp->buf, rp->buf + rp->pos, rp->len - rp->pos);
+	rp->len -= rp->pos;
+	rp->pos = 0;
+	if (rp->len == rp->alloc) {
+		// a line longer than the buffer.
+		rp->alloc *= 2;
+		rp->buf = realloc(rp->buf, rp->alloc);
+		if (!rp->buf) {
+			fprintf(errfp, "%s: out of memory\n", myname);
+			bail();
+		}
 	}
-	if (i >= sizeof lbuf) {
-		fprintf(stderr, "%s: internal error: field too long\n", myname);
-		exit(1);
+	n = read(rp->fd, rp->buf + rp->len, rp->alloc - rp->len);
+	if (n < 0) {
+		fprintf(errfp, "%s: %s\n", myname, strerror(errno));
+		bail();
 	}
+	if (n == 0)
+		rp->eof = 1;
+	rp->len += n;
+	return 1;
+}
 
-	// zero length field?
-	if (q == lbuf) {
-		if (!*p)
-			return NULL;
-		else
-			return p;
+/*
+ * Split the next line of input into fields, in rp->f.
+ * Trailing empty fields are dropped.
+ * Returns the number of fields, or -1 at end of file.
+ */
+static int
+read_line(struct reader_s *rp)
+{
+	char *p, *e, *q;
+	size_t scanned;
+
+	scanned = 0;
+	for (;;) {
+		p = rp->buf + rp->pos;
+		e = memchr(p + scanned, '\n', rp->len - rp->pos - scanned);
+		if (e)
+			break;
+		scanned = rp->len - rp->pos;
+		if (!reader_fill(rp)) {
+			if (rp->pos == rp->len)
+				return -1;
+			// last line has no newline.
+			p = rp->buf + rp->pos;
+			e = rp->buf + rp->len;
+			break;
+		}
+	}
+	rp->pos = e - rp->buf;
+	if (rp->pos < rp->len)
+		rp->pos++;
+	rp->lineno++;
+	if (e > p && e[-1] == '\r')
+		e--;
+
+	rp->nf = 0;
+	for (;;) {
+		q = memchr(p, ',', e - p);
+		if (!q)
+			q = e;
+		rp->f = grow(rp->f, &rp->falloc, rp->nf + 1, sizeof rp->f[0]);
+		rp->f[rp->nf].p = p;
+		rp->f[rp->nf].len = q - p;
+		rp->nf++;
+		if (q == e)
+			break;
+		p = q + 1;
 	}
+	while (rp->nf > 0 && !rp->f[rp->nf - 1].len)
+		rp->nf--;
+	return rp->nf;
+}
 
-	*q++ = '\0';
+/*
+ * Release the input.  Fields handed out are no longer valid.
+ */
+static void
+reader_close(struct reader_s *rp)
+{
+	if (rp->mapped)
+		munmap(rp->buf, rp->len);
+	else
+		free(rp->buf);
+	free(rp->f);
+	memset(rp, 0, sizeof *rp);
+}
 
-	// copy the string into some dynamically allocated memory and put that pointer in the right place.
-	*r = dscopy(lbuf);
+/*
+ * Parse an integer field.  Only what printf("%d") would print is accepted.
+ * Returns 0 if the field is not an integer.
+ */
+static int
+parse_int(struct field_s *fp, int *vp)
+{
+	char *p, *e;
+	int neg;
+	long long v;
+
+	p = fp->p;
+	e = p + fp->len;
+	neg = 0;
+	if (p < e && *p == '-') {
+		neg = 1;
+		p++;
+	}
+	if (p == e || (*p == '0' && (e - p > 1 || neg)))
+		return 0;
+	for (v = 0; p < e; p++) {
+		if (*p < '0' || *p > '9')
+			return 0;
+		v = v * 10 + (*p - '0');
+		if (v > INT_MAX)
+			return 0;
+	}
+	*vp = neg ? -v : v;
+	return 1;
+}
 
-	return p;
+/*
+ * Return the index of the candidate named in field fp, or -1 if there is none.
+ */
+static int
+find_candidate(struct field_s *fp)
+{
+	return election_find_candidate(election, fp->p, fp->len);
 }
 
 /*
- * Read the csv file on stdin, fill in the sr array
- * and the candidates array.
+ * In weighted mode, the header line gives the number of voters
+ * who cast each column's ballot.
  */
 static void
-input()
+input_weights(struct reader_s *rp)
 {
 	int i;
-	char *p;
-	int lineno;
+
+	voter_weight = grow(voter_weight, &voter_weight_alloc, rp->nf, sizeof voter_weight[0]);
+	for (i = 1; i < rp->nf; i++)
+		if (!parse_int(&rp->f[i], &voter_weight[i - 1]) || voter_weight[i - 1] < 1) {
+			fprintf(errfp, "%s: column %d has a bad ballot count (%.*s)\n",
+				myname, i, rp->f[i].len, rp->f[i].p);
+			bail();
+		}
+}
+
+/*
+ * Read the csv file open on fd, fill in the sr array
+ * and the names array.
+ */
+static void
+input(int fd)
+{
 	int c;
-	char lbuf[128];
+	int n;
+	struct reader_s *rd = &reader;
+	struct row_s *rp;
 
-	lineno = 0;
 	c = 0;
-	
-	/*
-	 * initialize the output arrays to have null pointers in them
-	 */
-	memset(sr, '\0', sizeof sr);
-	memset(candidates, '\0', sizeof candidates);
-	next_winner = 0;
+	num_columns = 0;
 
 	/*
 	 * Loop over the input file, one line at a time.
+	 * The rows keep pointing into the input, so read it whole.
+	 * The name and row arrays grow as needed, and come back zeroed.
 	 */
-	while ((fgets(lbuf, sizeof lbuf, stdin) == lbuf)) {
-		lineno++;
-		if (c >= MAX_CANDIDATES) {
-			fprintf(stderr, "%s input file has more than %d candidates\n",
-				myname,
-				MAX_CANDIDATES);
-			exit(1);
-		}
-		if (strlen(lbuf) >= sizeof lbuf - 1) {
-			fprintf(stderr, "%s: input line %d: line too long.\n",
-				myname, lineno);
-			exit(1);
+	reader_open(rd, fd, 1);
+	while ((n = read_line(rd)) >= 0) {
+		if (rd->lineno == 1 && n > 0 && rd->f[0].len == 10 &&
+		    strncasecmp(rd->f[0].p, "candidates", 10) == 0) {
+			// the header line.  Discard it, unless it holds weights.
+			if (weighted_mode)
+				input_weights(rd);
+			continue;
 		}
-		p = parsecsvf(lbuf, &(candidates[c].name));
-		if (lineno == 1 && strcasecmp(candidates[0].name, "candidates") == 0)
-			continue;	// discard the header line.
-		for (i = 0; i < MAX_VOTERS && p; i++)
-			p = parsecsvf(p, &(sr[i][c]));
-		if (p) {
-			fprintf(stderr, "%s: input line %d has more than %d voters\n",
-				myname,
-				lineno,
-				MAX_VOTERS);
-			exit(1);
+		if (rd->lineno == 1 && weighted_mode) {
+			fprintf(errfp, "%s: weighted mode needs a header line of ballot counts\n",
+				myname);
+			bail();
 		}
+		names = grow(names, &names_alloc, c + 1, sizeof names[0]);
+		sr = grow(sr, &sr_alloc, c + 1, sizeof sr[0]);
+		if (n > 0 && rd->f[0].len)
+			names[c] = dscopy(&rd->f[0]);
+
+		// the voters' cells for this row.
+		rp = &sr[c];
+		rp->n = n > 1 ? n - 1 : 0;
+		rp->v = zalloc(rp->n, sizeof rp->v[0]);
+		memcpy(rp->v, rd->f + 1, rp->n * sizeof rp->v[0]);
+		if (rp->n > num_columns)
+			num_columns = rp->n;
 		c++;
 	}
+	num_rows = c;
+}
+
+/*
+ * Use the narrowest rank that can hold num_candidates.
+ */
+static void
+pick_rank_width()
+{
+	if (num_candidates <= UINT8_MAX)
+		rank_width = 1;
+	else if (num_candidates <= UINT16_MAX)
+		rank_width = 2;
+	else
+		rank_width = 4;
+}
+
+/*
+ * Allocate the integer matrix, all zeroes.
+ */
+static void
+alloc_rankings()
+{
+	pick_rank_width();
+	rankings = zalloc((size_t)num_voters * num_candidates, rank_width);
+}
+
+static int
+get_rank(int i, int j)
+{
+	size_t k = (size_t)i * num_candidates + j;
+
+	switch (rank_width) {
+	case 1:
+		return ((uint8_t *)rankings)[k];
+	case 2:
+		return ((uint16_t *)rankings)[k];
+	}
+	return ((int *)rankings)[k];
+}
+
+static void
+set_rank(int i, int j, int r)
+{
+	size_t k = (size_t)i * num_candidates + j;
+
+	switch (rank_width) {
+	case 1:
+		((uint8_t *)rankings)[k] = r;
+		break;
+	case 2:
+		((uint16_t *)rankings)[k] = r;
+		break;
+	default:
+		((int *)rankings)[k] = r;
+	}
+}
+
+/*
+ * Fill in pairs[] with the (candidate, rank) pairs of voter i's ballot.
+ * Returns the number of candidates ranked.
+ */
+#define	ROW_PAIRS(type)							\
+	{								\
+		type *row = (type *)rankings + (size_t)i * num_candidates; \
+		for (c = 0; c < num_candidates; c++)			\
+			if (row[c]) {					\
+				pairs[2 * n] = c;			\
+				pairs[2 * n + 1] = row[c];		\
+				n++;					\
+			}						\
+	}
+
+static int
+ballot_pairs(int i, int *pairs)
+{
+	int c, n;
+
+	n = 0;
+	switch (rank_width) {
+	case 1:
+		ROW_PAIRS(uint8_t)
+		break;
+	case 2:
+		ROW_PAIRS(uint16_t)
+		break;
+	default:
+		ROW_PAIRS(int)
+	}
+	return n;
 }
 
 /*
  * Does some basic error checking.
  * Also sets the number of candidates, voters, and rankings.
  */
-static int icheck_errors;
+static __thread int icheck_errors;
 static void
 icheck1()
 {
@@ -238,14 +689,13 @@ icheck1()
 	 * If so, error exit.
 	 * If not, set num_candidates.
 	 */
-	for (i = 0; i < MAX_CANDIDATES-1; i++)
-		if (!candidates[i].name)
+	for (i = 0; i < num_rows; i++)
+		if (!names[i])
 			break;
 	num_candidates = i;
-	next_loser = i - 1;
-	for (i++; i < MAX_CANDIDATES; i++)
-		if (candidates[i].name) {
-			fprintf(stderr, "%s: found a blank candidate.\n",
+	for (i++; i < num_rows; i++)
+		if (names[i]) {
+			fprintf(errfp, "%s: found a blank candidate.\n",
 				myname);
 			icheck_errors++;
 			break;
@@ -262,73 +712,80 @@ icheck2()
 	 * If so error exit.
 	 * If not set num_rankings[voter]
 	 */
-	for (i = 0; i < MAX_VOTERS; i++) {
-		for (j = 0; j < MAX_CANDIDATES-1; j++)
-			if (!sr[i][j])
+	num_rankings = zalloc(num_columns, sizeof num_rankings[0]);
+	for (i = 0; i < num_columns; i++) {
+		for (j = 0; j < num_rows; j++)
+			if (!cell(i, j))
 				break;
 		num_rankings[i] = j;
-		for (j++; j < MAX_CANDIDATES; j++) 
-			if (sr[i][j]) {
-				fprintf(stderr, "%s: gap in voter %d rankings\n",
+		for (j++; j < num_rows; j++) 
+			if (cell(i, j)) {
+				fprintf(errfp, "%s: gap in voter %d rankings\n",
 					myname, i);
 				icheck_errors++;
 			}
 	}
 
-	for (i = 0; i < MAX_VOTERS - 1; i++)
+	for (i = 0; i < num_columns; i++)
 		if (num_rankings[i] == 0)
 			break;
 	num_voters = i;
-	for (i++; i < MAX_VOTERS; i++)
+	for (i++; i < num_columns; i++)
 		if (num_rankings[i]) {
-			fprintf(stderr, "%s: found a blank voter column\n",
+			fprintf(errfp, "%s: found a blank voter column\n",
 				myname);
 			icheck_errors++;
 		}
 
 	if (icheck_errors) {
-		fprintf(stderr, "%s: exiting on il-formed matrix\n",
+		fprintf(errfp, "%s: exiting on il-formed matrix\n",
 			myname);
-		exit(1);
+		bail();
 	}
 } 
 
+/*
+ * Numeric mode version of icheck2() and iconv(), in one pass.
+ * Each cell is parsed once, checked, and stored in the integer matrix.
+ * Every column is a voter; blank cells are unranked candidates.
+ */
 static void
-ncheck2()
+nconv()
 {
 	int i, j, t;
-	char tbuf[128];
+	struct row_s *rp;
+	struct field_s *p;
+
+	num_voters = num_columns;
+	num_rankings = zalloc(num_columns, sizeof num_rankings[0]);
+	for (i = 0; i < num_columns; i++)
+		num_rankings[i] = num_candidates;
+	alloc_rankings();
 
 	/*
 	 * Did any voter give a rank < 1 or > number of candidates?
 	 * Or a rank that isn't an integer?
+	 * Walk the input a row at a time, the way it is stored.
 	 */
-	memset(num_rankings, '\0', sizeof num_rankings);
-	for (i = 0; i < MAX_VOTERS; i++) {
-		num_rankings[i] = num_candidates;
-		for (j = 0; j < MAX_CANDIDATES-1; j++) 
-			if (sr[i][j]) {
-				t = atoi(sr[i][j]);
-				sprintf(tbuf, "%d", t);
-				if (strcmp(tbuf, sr[i][j]) != 0) {
-					fprintf(stderr, "%s: voter %i row %d is not an integer (%s)\n",
-							myname, i, j, sr[i][j]);
-					icheck_errors++;
-				}
-				if (t < 1 || t > num_candidates) {
-					fprintf(stderr, "%s: votor %i gave rank %d to candidate %d outside range [1-%d]\n",
-							myname, i, t, j, num_candidates);
-					icheck_errors++;
-				}
-
-				if (j >= num_candidates) {
-					fprintf(stderr, "%s: votor %i gave a rank to an unknown candidate (%d)\n",
-							myname, i, j);
-					icheck_errors++;
-				}
-			}
-
-	}
+	for (j = 0, rp = sr; j < num_rows; j++, rp++)
+		for (i = 0, p = rp->v; i < rp->n; i++, p++) {
+			if (!p->len)
+				continue;
+			if (j >= num_candidates) {
+				fprintf(errfp, "%s: votor %i gave a rank to an unknown candidate (%d)\n",
+						myname, i, j);
+				icheck_errors++;
+			} else if (!parse_int(p, &t)) {
+				fprintf(errfp, "%s: voter %i row %d is not an integer (%.*s)\n",
+						myname, i, j, p->len, p->p);
+				icheck_errors++;
+			} else if (t < 1 || t > num_candidates) {
+				fprintf(errfp, "%s: votor %i gave rank %d to candidate %d outside range [1-%d]\n",
+						myname, i, t, j, num_candidates);
+				icheck_errors++;
+			} else
+				set_rank(i, j, t);
+		}
 }
 
 static void
@@ -336,21 +793,29 @@ icheck3()
 {
 	int i;
 
-	for (i = 0; i < MAX_VOTERS - 1; i++)
+	for (i = 0; i < num_columns; i++)
 		if (num_rankings[i] == 0)
 			break;
 	num_voters = i;
-	for (i++; i < MAX_VOTERS; i++)
+	for (i++; i < num_columns; i++)
 		if (num_rankings[i]) {
-			fprintf(stderr, "%s: found a blank voter column\n",
+			fprintf(errfp, "%s: found a blank voter column\n",
 				myname);
 			icheck_errors++;
 		}
 
+	for (i = 0; weighted_mode && i < num_voters; i++)
+		if (i >= voter_weight_alloc || !voter_weight[i]) {
+			fprintf(errfp, "%s: voter %d has no ballot count\n",
+				myname, i);
+			icheck_errors++;
+			break;
+		}
+
 	if (icheck_errors) {
-		fprintf(stderr, "%s: exiting on il-formed matrix\n",
+		fprintf(errfp, "%s: exiting on il-formed matrix\n",
 			myname);
-		exit(1);
+		bail();
 	}
 } 
 
@@ -362,25 +827,27 @@ print_num_rankings()
 {
 	int i;
 
-	printf("Num Rankings:\n");
+	fprintf(outfp, "Num Rankings:\n");
 	for (i = 0; i < num_voters; i++)
-		printf("\tv %2d: %d\n", i, num_rankings[i]);
+		fprintf(outfp, "\tv %2d: %d\n", i, num_rankings[i]);
 }
 
 static void
 print_sr_array()
 {
 	int v, i;
+	struct field_s *p;
 
-	printf("Input data:\n");
+	fprintf(outfp, "Input data:\n");
 	for (v = 0; v < num_voters; v++) {
-		printf("\tv %2d: ", v);
+		fprintf(outfp, "\tv %2d: ", v);
 		for (i = 0; i < num_rankings[v]; i++) {
 			if (i)
-				printf(", ");
-			printf("%s", sr[v][i]);
+				fprintf(outfp, ", ");
+			if ((p = cell(v, i)))
+				fprintf(outfp, "%.*s", p->len, p->p);
 		}
-		printf("\n");
+		fprintf(outfp, "\n");
 	}
 }
 
@@ -392,560 +859,501 @@ iconv()
 {
 	int errors;
 	int i, j, k;
-	int gave_ranking[MAX_CANDIDATES];
 
 	errors = 0;
-	memset(rankings, '\0', sizeof rankings);
+	alloc_rankings();
 
 	for (i = 0; i < num_voters; i++) {
-		memset(gave_ranking, 0, sizeof gave_ranking);
 		for (j = 0; j < num_rankings[i]; j++) {
-			for (k = 0; k < num_candidates; k++)
-				if (strcasecmp(sr[i][j], candidates[k].name) == 0) {
-					if (gave_ranking[k] == 1) {
-						fprintf(stderr, "%s: voter %d ranked candidate %s more than once.\n",
-							myname, i, candidates[k].name);
-						errors++;
-					}
-					gave_ranking[k]++;
-					rankings[i][k] = j + 1;
-					break;
-				}
-			if (k >= num_candidates) {
-				fprintf(stderr, "%s: voter %d ranked non-existant candidate %s\n",
+			k = find_candidate(cell(i, j));
+			if (k < 0) {
+				fprintf(errfp, "%s: voter %d ranked non-existant candidate %.*s\n",
 					myname,
 					i + 1,
-					sr[i][j]);
+					cell(i, j)->len, cell(i, j)->p);
 				errors++;
-			}
+			} else if (get_rank(i, k)) {
+				// already has a ranking from this voter.
+				fprintf(errfp, "%s: voter %d ranked candidate %s more than once.\n",
+					myname, i, names[k]);
+				errors++;
+			} else
+				set_rank(i, k, j + 1);
 		}
 	}
 	if (errors)
-		exit(1);
+		bail();
 }
 
 /*
- * Converts the string matrix into the integer matrix.
- * This version assumes the string matrix contains rankings, rather than names
+ * Tally the ballots in rankings.
+ * Identical ballots are merged by the election, so each distinct one
+ * is counted once.
  */
 static void
-nconv()
+tally_rankings()
 {
-	int i, j;
+	int i, n;
+	int *pairs;
 
-	memset(rankings, '\0', sizeof rankings);
-
-	for (i = 0; i < num_voters; i++) 
-		for (j = 0; j < num_rankings[i]; j++)
-			if (sr[i][j])
-				rankings[i][j] = atoi(sr[i][j]);
+	pairs = zalloc(2 * num_candidates, sizeof pairs[0]);
+	for (i = 0; i < num_voters; i++) {
+		n = ballot_pairs(i, pairs);
+		check(election_add_ballot(election, pairs, n,
+			weighted_mode ? voter_weight[i] : 1));
+	}
+	free(pairs);
+	check(election_tally(election));
 }
 
 /*
- * Debugging routine.
+ * Compiled ballots.
+ * With -c, the ballots are written to a file in the layout rankings[]
+ * has in memory, instead of being counted.  With -i, such a file is
+ * mapped and used as it is, with nothing to parse or look up.
+ *
+ * The file is a header, then the candidate names, each nul terminated,
+ * padded to 8 bytes.  Then num_voters records of num_candidates ranks,
+ * each rank_width bytes, 0 for unranked.  In weighted mode, the records
+ * are followed, at the next multiple of 4, by one 32 bit weight for each.
+ * Numbers are in the byte order of the machine that wrote the file.
  */
+#define	BALLOT_MAGIC	"RNKBAL01"
+
+struct ballot_header_s {
+	char magic[8];
+	int32_t num_candidates;
+	int32_t num_voters;
+	int32_t rank_width;
+	int32_t weighted;
+	int32_t names_len;
+	int32_t pad;
+};
+
+static FILE *compile_fp;
+static struct ballot_header_s compile_header;
+static char *compile_row;
+static int *compile_weights;
+static int compile_weights_alloc;
+
 static void
-print_ranking_array()
+compile_write(const void *p, size_t size, size_t n)
 {
-	int v;
-	int r;
-
-	printf("Rankings by Voter\n");
-	for (v = 0; v < num_voters; v++) {
-		printf("\tv %2d: ", v);
-		for (r = 0; r < num_candidates; r++) {
-			if (r)
-				printf(", ");
-			printf("%d", rankings[v][r]);
-		}
-		printf("\n");
+	if (fwrite(p, size, n, compile_fp) != n) {
+		fprintf(errfp, "%s: cannot write %s\n", myname, compile_file);
+		bail();
 	}
-	printf("\n");
 }
 
 /*
- * find out who is prefered to who by how much.
+ * Start the compiled file: the header, to be filled in at the end,
+ * and the candidate names.
  */
 static void
-create_majorities()
+compile_begin()
 {
-	int i, j;
-	int t;
-	int r1, r2;
-	struct majority_s *mp;
-
-	// init the array.
-	memset(majorities, 0, sizeof majorities);
-	mp = majorities;
-	for (i = 0; i < num_candidates - 1; i++)
-		for (j = i + 1; j < num_candidates; j++) {
-			mp->c1 = i;
-			mp->c2 = j;
-			mp++;
-		}
-
-	/*
-	 * Loop over all majorities, then all votors.
-	 * For this majority record this voter's preference.
-	 */
-	num_majorities = num_candidates * (num_candidates - 1) / 2;
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		for (j = 0; j < num_voters; j++) {
-			r1 = rankings[j][mp->c1];
-			r2 = rankings[j][mp->c2];
-			if (r1 && r2) {
-				if (r1 < r2)
-					mp->strength++;
-				else if (r1 > r2)
-					mp->strength--;
-			} else if (r1)
-				mp->strength++;
-			else if (r2)
-				mp->strength--;
-		}
-	
-	/*
-	 * Loop over all majorities.
-	 * Count the number of tie votes.
-	 * Normalize the majorities so c1 always wins.
-	 */
-	j = 0;
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		if (mp->strength == 0)
-			j++;
-		else if (mp->strength < 0) {
-			t = mp->c1;
-			mp->c1 = mp->c2;
-			mp->c2 = t;
-			mp->strength = -mp->strength;
-		}
-	if (j && verbose)
-		printf("Warning: %d ties were found.\n", j);
+	int i;
+	size_t len;
+	const char *name;
+	static const char zeroes[8];
+
+	compile_fp = fopen(compile_file, "wb");
+	if (!compile_fp) {
+		fprintf(errfp, "%s: %s: %s\n", myname, compile_file, strerror(errno));
+		bail();
+	}
+	if (!rank_width)
+		pick_rank_width();
+	memset(&compile_header, 0, sizeof compile_header);
+	memcpy(compile_header.magic, BALLOT_MAGIC, 8);
+	compile_write(&compile_header, sizeof compile_header, 1);
+	len = 0;
+	for (i = 0; i < num_candidates; i++) {
+		name = election_candidate_name(election, i);
+		compile_write(name, 1, strlen(name) + 1);
+		len += strlen(name) + 1;
+	}
+	compile_write(zeroes, 1, -len & 7);
+	compile_header.names_len = len + (-len & 7);
+	compile_row = zalloc(num_candidates, rank_width);
 }
 
-/* DEBUGGING ROUTINE */
+/*
+ * Write one line mode ballot, cast by w voters, as a record.
+ */
 static void
-check_majorities(char *s)
+compile_ballot(int *pairs, int n, int w)
 {
-	int i;
-	struct majority_s *mp;
+	int i, c;
 
-	fprintf(stderr, "checking majorities: %s\n", s);
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		if (mp->c1 == mp->c2) {
-			fprintf(stderr, "majority %d is bad (%d)\n",
-				i, mp->c1);
-			exit(1);
+	memset(compile_row, 0, (size_t)num_candidates * rank_width);
+	for (i = 0; i < n; i++) {
+		c = pairs[2 * i];
+		switch (rank_width) {
+		case 1:
+			((uint8_t *)compile_row)[c] = pairs[2 * i + 1];
+			break;
+		case 2:
+			((uint16_t *)compile_row)[c] = pairs[2 * i + 1];
+			break;
+		default:
+			((int *)compile_row)[c] = pairs[2 * i + 1];
 		}
+	}
+	compile_write(compile_row, rank_width, num_candidates);
+	if (weighted_mode) {
+		compile_weights = grow(compile_weights, &compile_weights_alloc,
+			compile_header.num_voters + 1, sizeof compile_weights[0]);
+		compile_weights[compile_header.num_voters] = w;
+	}
+	compile_header.num_voters++;
 }
 
-/* 
- * return 0 if cannot figure out two majorities
- * return -1 if first majority is more important than second.
- * return 1 if second majority is more important than first
- *
- * Record if we ever returned 0.
+/*
+ * Write the weights and finish the header.
  */
-static int
-compar(const void *p, const void *q)
+static void
+compile_end(int *weights)
 {
-	int i;
-	int lp, lq;
-	const struct majority_s *mp = p;
-	const struct majority_s *mq = q;
-	struct majority_s *mr;
-
-	if (mp->strength > mq->strength)
-		return -1;
-	if (mp->strength < mq->strength)
-		return 1;
+	static const char zeroes[4];
+	size_t len;
 
-	/*
-	 * Tie.  Look to race between losers.
-	 */
-	lp = mp->c2;
-	lq = mq->c2;
-	
-	/*
-	 * Call it a tie if both won against the same loser
-	 */
-	if (lp == lq) {
-		ranking_tie = 1;
-		return 0;
+	len = (size_t)compile_header.num_voters * num_candidates * rank_width;
+	if (weighted_mode) {
+		compile_write(zeroes, 1, -len & 3);
+		compile_write(weights, sizeof weights[0], compile_header.num_voters);
 	}
-	
-	/*
-	 * Find the race that was between the losers.
-	 */
-	for (i = 0, mr = majorities; i < num_majorities; i++, mr++)
-		if ((mr->c1 == lp && mr->c2 == lq) ||
-		    (mr->c2 == lp && mr->c1 == lq))
-		     	break;
-	if (i == num_majorities) {
-		fprintf(stderr, "%s: internal error in compar.\n", myname);
-		fprintf(stderr, "\tlp = %d, lq = %d\n", lp, lq);
-		exit(1);
-	}
-
-	/*
-	 * If the losers tied, then we are tied.
-	 */
-	if (mr->strength == 0) {
-		ranking_tie = 1;
-		return 0;
+	compile_header.num_candidates = num_candidates;
+	compile_header.rank_width = rank_width;
+	compile_header.weighted = weighted_mode;
+	if (fseek(compile_fp, 0, SEEK_SET) == 0)
+		compile_write(&compile_header, sizeof compile_header, 1);
+	if (ferror(compile_fp) || fclose(compile_fp)) {
+		fprintf(errfp, "%s: cannot write %s\n", myname, compile_file);
+		bail();
 	}
-
-	/*
-	 * P wins if Q's loser beats P's loser.
-	 */
-	if (lq == mr->c1)
-		return -1;
-	return 1;
+	free(compile_row);
+	free(compile_weights);
 }
 
-static int
-count_tied_majorities()
+/*
+ * Compile the column mode ballots, which are already in rankings[].
+ */
+static void
+compile_rankings()
 {
-	int i, j;
-	int count;
-
-	count = 0;
-	for (i = 0; i < num_majorities - 1; i++)
-		for (j = i + 1; j < num_majorities; j++)
-			if (compar(majorities + i, majorities + j) == 0)
-				count++;
-	return count;
+	compile_begin();
+	compile_write(rankings, rank_width, (size_t)num_voters * num_candidates);
+	compile_header.num_voters = num_voters;
+	compile_end(voter_weight);
 }
 
 static void
-do_sort()
+load_damaged(char *file)
 {
-	qsort(majorities, num_majorities, sizeof majorities[0], compar);
+	fprintf(errfp, "%s: %s is damaged\n", myname, file);
+	bail();
 }
 
-static int
-remove_m(const void *p, const void *q)
-{
-	const struct majority_s *mp = p;
-	const struct majority_s *mq = q;
-
-	return mp->flag - mq->flag;
-}
+#define	CHECK_RANKS(type)						\
+	{								\
+		const type *r = (const type *)rankings;			\
+		for (k = 0; k < n; k++)					\
+			if ((uint32_t)r[k] > (uint32_t)num_candidates)	\
+				load_damaged(file);			\
+	}
 
+/*
+ * Map a compiled ballot file, and point rankings[] and voter_weight[]
+ * into it.  The candidate names go to the election.
+ */
 static void
-remove_pairings(struct candidate_s *cp)
+load_ballots(char *file)
 {
-	int i, c;
-	int n;
-	struct majority_s *mp;
-
-	c = cp - candidates;
+	int fd, i;
+	char *map, *p, *q, *end;
+	size_t size, need, n, k;
+	struct stat st;
+	struct ballot_header_s h;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(errfp, "%s: %s: %s\n", myname, file, strerror(errno));
+		bail();
+	}
+	size = st.st_size;
+	map = size < sizeof h ? MAP_FAILED :
+		mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map != MAP_FAILED) {
+		compiled_map = map;
+		compiled_len = size;
+	}
+	if (map == MAP_FAILED || memcmp(map, BALLOT_MAGIC, 8)) {
+		fprintf(errfp, "%s: %s is not a compiled ballot file\n", myname, file);
+		bail();
+	}
+	memcpy(&h, map, sizeof h);
+
+	// check each count before it is used, so need cannot wrap.
+	if (h.num_candidates < 0 || h.num_voters < 0 ||
+	    h.names_len < 0 || (h.names_len & 7) ||
+	    (h.rank_width != 1 && h.rank_width != 2 && h.rank_width != 4) ||
+	    (h.rank_width == 1 && h.num_candidates > UINT8_MAX) ||
+	    (h.rank_width == 2 && h.num_candidates > UINT16_MAX) ||
+	    (size_t)h.names_len > size - sizeof h ||
+	    (h.num_candidates && (size_t)h.num_voters >
+	     (size - sizeof h - h.names_len) / h.rank_width / h.num_candidates))
+		load_damaged(file);
+	need = sizeof h + (size_t)h.names_len +
+		(size_t)h.num_voters * h.num_candidates * h.rank_width;
+	if (h.weighted) {
+		need += -need & 3;
+		if (need > size || (size - need) / sizeof(int32_t) < (size_t)h.num_voters)
+			load_damaged(file);
+	}
 
-	n = 0;
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		if (mp->c1 == c || mp->c2 == c) {
-			mp->flag = 1;
-			n++;
-		} else
-			mp->flag = 0;
-
-	// sort the dead ones to the end.
-	qsort(majorities, num_majorities, sizeof majorities[0], remove_m);
-	num_majorities -= n;
-}
+	num_candidates = h.num_candidates;
+	p = map + sizeof h;
+	end = p + h.names_len;
+	for (i = 0; i < num_candidates; i++) {
+		q = memchr(p, '\0', end - p);
+		if (!q)
+			load_damaged(file);
+		check(election_add_candidate(election, p, q - p));
+		p = q + 1;
+	}
 
-static void
-pull_unranked_losers()
-{
-	int i, j;
-	int count;
-	struct candidate_s *cp;
-
-	count = 0;
-	// loop over all canidates not already ranked.
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++)
-		if (!cp->ranking_source) {
-			// look to see if any voter gave this candidate a rank.
-			for (j = 0; j < num_voters; j++)
-				if (rankings[j][i])
-					break;
-			if (j >= num_voters) {
-				// candidate was unranked
-				cp->ranking_source = RANKING_LOSER;
-				cp->ranking_phase = ranking_phase;
-				count++;
-			}
-		}
-	
-	// loop over all candidates give the RANKING_LOSER status
-	if (count) {
-		next_loser -= count - 1;
-		for (i = 0, cp = candidates; i < num_candidates; i++, cp++)
-			if (cp->ranking_source == RANKING_LOSER) {
-				cp->ranking = next_loser;
-				remove_pairings(cp);
-			}
-		next_loser--;
-		ranking_phase++;
+	num_voters = h.num_voters;
+	rank_width = h.rank_width;
+	rankings = end;
+	weighted_mode = h.weighted;
+	if (weighted_mode)
+		voter_weight = (int *)(map + need);
+
+	// the ranks and counts go straight to the tally; see they are sound.
+	n = (size_t)num_voters * num_candidates;
+	switch (rank_width) {
+	case 1:
+		CHECK_RANKS(uint8_t)
+		break;
+	case 2:
+		CHECK_RANKS(uint16_t)
+		break;
+	default:
+		CHECK_RANKS(int32_t)
 	}
+	if (weighted_mode)
+		for (i = 0; i < num_voters; i++)
+			if (voter_weight[i] < 1)
+				load_damaged(file);
 }
 
 /*
- * If any of the candidates are Condorcet winners, because they beat all others,
- * or Condorcet losers, because they are beat by all others, then
- * we know their rankings.
+ * Line mode input.
+ * Read the csv file open on fd, one ballot per line, and hand each ballot
+ * to the election as it is read.  It keeps nothing but the pairwise counts.
  *
- * returns true if any candidates were found and pulled out.
+ * The first line lists the candidates.  Each line after that is a ballot:
+ * in normal mode the names of the candidates the voter ranked, best first;
+ * in numeric mode the rank given to each candidate, in the order of the first line.
  */
-static int
-pull_condorcet()
+static void
+input_ballots(int fd)
 {
-	int i;
-	int count;
-	struct majority_s *mp;
-	struct candidate_s *cp, *wp, *lp;
-	
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++) {
-		cp->wins_pair = 0;
-		cp->loses_pair = 0;
-		cp->ties = 0;
-	}
-
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		if (mp->strength) {
-			candidates[mp->c1].wins_pair = 1;
-			candidates[mp->c2].loses_pair = 1;
-		} else {
-			candidates[mp->c1].ties = 1;
-			candidates[mp->c2].ties = 1;
-		}
-			
-
-	// how many only win, never lose?
-	count = 0;
-	wp = NULL;
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++)
-		if (cp->wins_pair && !cp->loses_pair && !cp->ties) {
-			count++;
-			wp = cp;
+	int i, k, n, t;
+	int f0, w;
+	int errors;
+	int nfields;
+	struct field_s *p;
+	struct reader_s *rd = &reader;
+	int *seen;
+	int *pairs;
+
+	errors = 0;
+	num_voters = 0;
+	seen = NULL;
+	pairs = NULL;
+
+	reader_open(rd, fd, 0);
+	while ((nfields = read_line(rd)) >= 0) {
+		if (rd->lineno == 1) {
+			// the candidate list.
+			i = 0;
+			if (nfields > 0 && rd->f[0].len == 10 &&
+			    strncasecmp(rd->f[0].p, "candidates", 10) == 0)
+				i = 1;
+			for (; i < nfields; i++) {
+				if (!rd->f[i].len) {
+					fprintf(errfp, "%s: found a blank candidate.\n",
+						myname);
+					bail();
+				}
+				check(election_add_candidate(election, rd->f[i].p, rd->f[i].len));
+				num_candidates++;
+			}
+			seen = zalloc(num_candidates, sizeof seen[0]);
+			pairs = zalloc(2 * num_candidates, sizeof pairs[0]);
+			if (compile_file)
+				compile_begin();
+			continue;
 		}
 
-	// If we have exactly one winner, they are the Condorcet winner.
-	if (count == 1) {
-		wp->ranking = next_winner++;
-		wp->ranking_source = RANKING_C_WINNER;
-		wp->ranking_phase = ranking_phase;
-	} else
-		wp = NULL;
-
-	// how many only lose, never win??
-	count = 0;
-	lp = NULL;
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++)
-		if (!cp->wins_pair && cp->loses_pair && cp->ties) {
-			count++;
-			lp = cp;
+		// a blank line is not a ballot.
+		if (nfields == 0)
+			continue;
+		num_voters++;
+
+		// in weighted mode, the first value is the number of voters.
+		f0 = 0;
+		w = 1;
+		if (weighted_mode) {
+			f0 = 1;
+			if (!parse_int(&rd->f[0], &w) || w < 1) {
+				fprintf(errfp, "%s: line %d has a bad ballot count (%.*s)\n",
+					myname, rd->lineno, rd->f[0].len, rd->f[0].p);
+				errors++;
+				continue;
+			}
 		}
 
-	// If we have exactly one loser, they are the Condorcet loser.
-	if (count == 1) {
-		lp->ranking = next_loser--;
-		lp->ranking_source = RANKING_C_LOSER;
-		lp->ranking_phase = ranking_phase;
-	} else
-		lp = NULL;
+		n = 0;
+		if (numeric_mode) {
+			if (nfields - f0 > num_candidates) {
+				fprintf(errfp, "%s: line %d gave a rank to an unknown candidate (%d)\n",
+					myname, rd->lineno, nfields - f0 - 1);
+				errors++;
+				nfields = num_candidates + f0;
+			}
+			for (k = 0; k < nfields - f0; k++) {
+				p = &rd->f[f0 + k];
+				if (!p->len)
+					continue;
+				if (!parse_int(p, &t)) {
+					fprintf(errfp, "%s: line %d candidate %d is not an integer (%.*s)\n",
+						myname, rd->lineno, k, p->len, p->p);
+					errors++;
+				} else if (t < 1 || t > num_candidates) {
+					fprintf(errfp, "%s: line %d gave rank %d to candidate %d outside range [1-%d]\n",
+						myname, rd->lineno, t, k, num_candidates);
+					errors++;
+				} else {
+					pairs[2 * n] = k;
+					pairs[2 * n + 1] = t;
+					n++;
+				}
+			}
+		} else {
+			for (i = 0; i < nfields - f0; i++) {
+				p = &rd->f[f0 + i];
+				if (!p->len) {
+					fprintf(errfp, "%s: gap in line %d rankings\n",
+						myname, rd->lineno);
+					errors++;
+					continue;
+				}
+				k = find_candidate(p);
+				if (k < 0) {
+					fprintf(errfp, "%s: line %d ranked non-existant candidate %.*s\n",
+						myname, rd->lineno, p->len, p->p);
+					errors++;
+				} else if (seen[k] == rd->lineno) {
+					fprintf(errfp, "%s: line %d ranked candidate %s more than once.\n",
+						myname, rd->lineno, election_candidate_name(election, k));
+					errors++;
+				} else {
+					seen[k] = rd->lineno;
+					pairs[2 * n] = k;
+					pairs[2 * n + 1] = i + 1;
+					n++;
+				}
+			}
+		}
 
-	count = 0;
-	if (wp) {
-		remove_pairings(wp);
-		count++;
+		if (compile_file) {
+			compile_ballot(pairs, n, w);
+			continue;
+		}
+		check(election_add_ballot(election, pairs, n, w));
 	}
-	if (lp) {
-		remove_pairings(lp);
-		count++;
+	// an empty input has no candidate line, but still compiles.
+	if (compile_file && rd->lineno < 1)
+		compile_begin();
+	if (!compile_file)
+		check(election_tally(election));
+	free(seen);
+	free(pairs);
+
+	if (errors) {
+		fprintf(errfp, "%s: exiting on il-formed ballots\n",
+			myname);
+		bail();
 	}
-	if (wp || lp)
-		ranking_phase++;
-	return count;
-}
-
-/*
- * Is there a path from c2 to c1?
- *
- * An arc goes from x to y if these exists i such that
- *  majorities[i].locked
- *  majorities[i].c1==x
- *  majorities[i].c2==y
- */
-static int
-path_to(int c1, int c2)
-{
-	int i;
-	struct majority_s *mp;
-
-	// is there a direct arc from c2 to c1?
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		if (mp->locked && mp->c1 == c2)
-			// is there an arc?
-			if (mp->c2 == c1)
-				return 1;
-	
-	// is there a path from c2 to c1?
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		if (mp->locked && mp->c1 == c2) 
-			// there is an arc from c2 to mp->c2.
-			// is there a path from mp->c2 to c1?
-			if (path_to(c1, mp->c2))
-				return 1;
-	return 0;
 }
 
 /*
- * This routine "locks" all pairings that can be locked.
- * Pairings are locked in turn, provided they do not create
- * a cycle in the graph.
+ * Partial tallies.
+ * With -o, the pairwise counts are written to a file instead of being
+ * ranked, so that precincts can be counted on different machines.
+ * With -m, any number of these files are read back and added up.
+ * The election reads and writes them; see election_write_tally().
  */
 static void
-do_lock()
+write_partial()
 {
-	int i;
-	int not_locked;
-	struct majority_s *mp;
+	FILE *fp;
 
-	not_locked = 0;
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++) {
-		if (!path_to(mp->c1, mp->c2))
-			mp->locked++;
-		else
-			not_locked++;
+	fp = fopen(partial_file, "wb");
+	if (!fp) {
+		fprintf(errfp, "%s: %s: %s\n", myname, partial_file, strerror(errno));
+		bail();
+	}
+	check(election_write_tally(election, fp, partial_file));
+	if (fclose(fp)) {
+		fprintf(errfp, "%s: cannot write %s\n", myname, partial_file);
+		bail();
 	}
-	if (verbose)
-		printf("%d pairings were locked, %d were not locked.\n",
-			num_majorities - not_locked, not_locked);
 }
 
 /*
- * Find all the winners by the ranked pairs method.
+ * Add one partial tally file into the election.
+ * The first file sets the candidates.  The rest must have the same
+ * ones, in any order; they are matched by name.
  */
 static void
-find_rp_winners()
+merge_partial(char *file)
 {
-	int i;
-	int count;
-	struct majority_s *mp;
-	struct candidate_s *cp;
-	int is_not_winner[MAX_CANDIDATES];
-	int mentioned[MAX_CANDIDATES];
-
-	memset(is_not_winner, 0, sizeof is_not_winner);
-	memset(mentioned, 0, sizeof is_not_winner);
-
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++) {
-		mentioned[mp->c1] = 1;
-		mentioned[mp->c2] = 1;
-		if (mp->locked)
-			is_not_winner[mp->c2] = 1;
-	}
-
-	count = 0;
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++)
-		if (mentioned[i] && !is_not_winner[i]) {
-			count++;
-			cp->ranking = next_winner;
-			cp->ranking_source = RANKING_T_WINNER;
-			cp->ranking_phase = ranking_phase;
-			remove_pairings(cp);
-		}
-	next_winner += count;
-	if (verbose)
-		printf("Ranked pairs yielded %d winners at phase %d\n", count, ranking_phase+1);
-	if (count)
-		ranking_phase++;
-}
-
-/*
- * Sort the candidates and print them out.
- */
-static int
-rank_order(const void *p, const void *q)
-{
-	const struct candidate_s *cp = p;
-	const struct candidate_s *cq = q;
-
-	return cp->ranking - cq->ranking;
-}
+	FILE *fp;
 
-static void
-print_rankings()
-{
-	int i;
-	int count;
-	int source;
-	int ranking_tie_phase;
-	char flag;
-	struct candidate_s *cp;
-
-	source = RANKING_NONE;
-	count = 0;
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++) {
-		if (ranking_tie_phase < 0 && cp->ranking_source == RANKING_T_WINNER)
-			ranking_tie_phase = cp->ranking_phase;
-		if (!cp->ranking_source)
-			count++;
-	}
-	if (count == 1)
-		source = RANKING_T_LOSER;
-
-	printf("\n Name     Rank Phase Ranking Source\n");
-
-	// all candidates not yet ranked are tied for middle.
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++) {
-		if (!cp->ranking_source) {
-			cp->ranking_source = source;
-			cp->ranking = next_winner;
-			cp->ranking_phase = ranking_phase;
-		}
-	}
-
-	qsort(candidates, num_candidates, sizeof candidates[0], rank_order);
-
-	ranking_tie_phase = -1;
-	if (ranking_tie)
-		for (i = 0, cp = candidates; i < num_candidates; i++, cp++)
-			if (cp->ranking_source == RANKING_T_WINNER) {
-				ranking_tie_phase = cp->ranking_phase;
-				break;
-			}
-
-	for (i = 0, cp = candidates; i < num_candidates; i++, cp++) {
-		flag = ' ';
-		if (ranking_tie_phase >= 0 && cp->ranking_phase >= ranking_tie_phase)
-			flag = '*';
-		printf("%10s %3d%c %4d  %s\n",
-			cp->name,
-			cp->ranking + 1,
-			flag,
-			cp->ranking_phase + 1,
-			ranking_source_names[cp->ranking_source]);
+	fp = fopen(file, "rb");
+	if (!fp) {
+		fprintf(errfp, "%s: %s: %s\n", myname, file, strerror(errno));
+		bail();
 	}
+	check(election_merge_tally(election, fp, file));
+	fclose(fp);
 }
 
 /*
  * Debugging routine.
  */
 static void
-print_majorities()
+print_ranking_array()
 {
-	int i;
-	struct majority_s *mp;
-
-	printf("Majorities\n");
-	for (i = 0, mp = majorities; i < num_majorities; i++, mp++)
-		printf("\t%10s > %10s strength %3d\n",
-			candidates[mp->c1].name,
-			candidates[mp->c2].name,
-			mp->strength);
-	printf("\n");
+	int v;
+	int r;
+
+	fprintf(outfp, "Rankings by Voter\n");
+	for (v = 0; v < num_voters; v++) {
+		fprintf(outfp, "\tv %2d: ", v);
+		for (r = 0; r < num_candidates; r++) {
+			if (r)
+				fprintf(outfp, ", ");
+			fprintf(outfp, "%d", get_rank(v, r));
+		}
+		fprintf(outfp, "\n");
+	}
+	fprintf(outfp, "\n");
 }
 
 static void
@@ -953,6 +1361,19 @@ set_defaults() {
 	debug = 0;
 	verbose = 0;
 	numeric_mode = 0;
+	line_mode = 0;
+	num_threads = 1;
+	weighted_mode = 0;
+	timing = 0;
+	merge_mode = 0;
+	partial_file = NULL;
+	compile_file = NULL;
+	compiled_input = NULL;
+	batch_list = NULL;
+	resamples = 0;
+	boot_seed = 1;
+	all_outcomes = 0;
+	sparse_mode = 0;
 }
 
 static void
@@ -960,10 +1381,26 @@ usage()
 {
 	set_defaults();
 	fprintf(stderr, "Usage: %s [options] <input\n", myname);
+	fprintf(stderr, "       %s [options] -i compiled\n", myname);
+	fprintf(stderr, "       %s [options] -m partial ...\n", myname);
+	fprintf(stderr, "       %s [options] -B list\n", myname);
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "\t-v <verbose mode>\n");
 	fprintf(stderr, "\t-d <debugging>\n");
 	fprintf(stderr, "\t-n <numeric input mode.  See long help.>\n");
+	fprintf(stderr, "\t-b <one ballot per line input mode.  See long help.>\n");
+	fprintf(stderr, "\t-j N <count ballots with N threads>\n");
+	fprintf(stderr, "\t-w <weighted input: each ballot has a voter count.  See long help.>\n");
+	fprintf(stderr, "\t-p <sparse tally: count only pairs ranked together.  See long help.>\n");
+	fprintf(stderr, "\t-T <time each stage and count the hot calls, on stderr.  See long help.>\n");
+	fprintf(stderr, "\t-c file <compile the ballots to file, and do not rank>\n");
+	fprintf(stderr, "\t-i file <read ballots compiled with -c>\n");
+	fprintf(stderr, "\t-o file <write a partial tally to file, and do not rank>\n");
+	fprintf(stderr, "\t-m <add up the partial tallies named, and rank them>\n");
+	fprintf(stderr, "\t-B list <count each csv file in list as an election.  See long help.>\n");
+	fprintf(stderr, "\t-a <print every ranking that tied majorities could give.  See long help.>\n");
+	fprintf(stderr, "\t-r N <rank N bootstrap resamples of the ballots.  See long help.>\n");
+	fprintf(stderr, "\t-s seed <random seed for -r, default 1>\n");
 	fprintf(stderr, "\t-h <print long help and exit>\n");
 	exit(1);
 }
@@ -993,7 +1430,77 @@ long_help()
 	"    file is a list of the candidates, in no particular order.\n"
 	"    The rest of the columns contain integers.  The integer in\n"
 	"    column X row Y is the rank given by voter in column X to the\n"
-	"    candidate in column Y.	Ties, gaps, etc are possible.\n";
+	"    candidate in column Y.	Ties, gaps, etc are possible.\n"
+	"\n"
+	"    In line mode (-b), the file is read one ballot at a time and\n"
+	"    only the pairwise counts are kept, so it may be any size.\n"
+	"    The first line lists the candidates.  Its first value may be\n"
+	"    \"candidates\", which is ignored.  Each subsequent line is one\n"
+	"    ballot, listing the candidates ranked by that voter, best first.\n"
+	"    With -n as well, each ballot line instead holds the rank given\n"
+	"    to each candidate, in the order of the first line.  A blank\n"
+	"    value means that candidate was not ranked.\n"
+	"\n"
+	"    In weighted mode (-w), each ballot stands for a number of\n"
+	"    identical ballots, as in precinct totals.  In line mode the\n"
+	"    first value on each ballot line is the count.  Otherwise the\n"
+	"    header line is required, and gives the count for each column.\n"
+	"    Identical ballots are always merged before they are counted.\n"
+	"\n"
+	"    With -p, only the pairs of candidates ranked on the same ballot\n"
+	"    are counted.  How a ranked candidate fares against one the\n"
+	"    voter left off follows from how often each was ranked.  The\n"
+	"    result is the same, but the memory the tally needs grows with\n"
+	"    the pairs the ballots rank rather than with the square of the\n"
+	"    number of candidates.  Ranking still takes memory that grows\n"
+	"    with the square of the number ranked at all, so -p saves only\n"
+	"    the pairwise matrix.  It does not go with -o, -m or -r.\n"
+	"\n"
+	"    With -o file, the ballots are counted but not ranked.  The\n"
+	"    candidates and pairwise counts are written to file instead.\n"
+	"    With -m, the arguments are such files, perhaps from different\n"
+	"    precincts.  Their counts are added up and ranked as if all the\n"
+	"    ballots had been in one input.  Each file must have the same\n"
+	"    candidates, in any order.  -m and -o together merge partial\n"
+	"    tallies into a new one.  The files are in the byte order of\n"
+	"    the machine that wrote them.\n"
+	"\n"
+	"    With -B list, each csv file named in list, one per line, is\n"
+	"    counted and ranked as an election of its own.  If list is a\n"
+	"    directory, the files are the .csv files in it, in order of name.\n"
+	"    -j sets how many are counted at once.  The results come out in\n"
+	"    order, each after a line \"Contest: file\".  A bad file is\n"
+	"    reported and skipped, and the exit status is then 1.  The other\n"
+	"    input options apply to every file.\n"
+	"\n"
+	"    With -a, when majorities of equal strength cannot be ordered,\n"
+	"    every distinct ranking that some order of them gives is listed\n"
+	"    after the result, best first, with \"=\" between tied\n"
+	"    candidates.  The first is the one shown above it.  If there are\n"
+	"    too many to search, the list says how many were found, and that\n"
+	"    there may be more.\n"
+	"\n"
+	"    With -r N, the ballots are also resampled N times, and each\n"
+	"    resample is ranked.  A table follows the result giving, for\n"
+	"    each candidate, the share of the resamples in which they came\n"
+	"    in each place.  Each resample counts every ballot a random\n"
+	"    number of times, Poisson distributed with mean 1 (the Poisson\n"
+	"    bootstrap).  -j sets how many are ranked at once, and -s sets\n"
+	"    the random seed; the same seed gives the same table.\n"
+	"\n"
+	"    With -c file, the ballots are checked and written to file in\n"
+	"    a binary form instead of being counted.  -i file reads that\n"
+	"    back in place of the input, with nothing to parse, so it is\n"
+	"    quick to run the same election again.  The input options\n"
+	"    are taken from the file.  It is also in native byte order.\n"
+	"\n"
+	"    With -T, a tab separated report goes to stderr.  A line\n"
+	"    \"stage name seconds kbytes\" follows each stage: input,\n"
+	"    convert, tally, majorities, condorcet, count_ties (with -v),\n"
+	"    sort, outcomes (with -a), lock, rp_winners, bootstrap (with -r),\n"
+	"    output and total, with the peak memory use so far.  Then a\n"
+	"    line \"count name n\" for each of the hot calls: name_compares,\n"
+	"    compar, path_to, arc_rows, remove_pairings and compactions.\n";
 
 	fprintf(stderr, "%s: Long help:\n", myname);
 	fputs(msg, stderr);
@@ -1012,7 +1519,7 @@ grok_args(int argc, char **argv)
 	set_defaults();
 	errors = 0;
 
-	while ((c = getopt(argc, argv, "vhdn")) != EOF)
+	while ((c = getopt(argc, argv, "vhdnbwmTapj:o:c:i:B:r:s:")) != EOF)
 		switch(c) {
 			case 'v':
 				verbose++;
@@ -1023,6 +1530,55 @@ grok_args(int argc, char **argv)
 			case 'n':
 				numeric_mode++;
 				break;
+			case 'b':
+				line_mode++;
+				break;
+			case 'w':
+				weighted_mode++;
+				break;
+			case 'm':
+				merge_mode++;
+				break;
+			case 'T':
+				timing++;
+				break;
+			case 'o':
+				partial_file = optarg;
+				break;
+			case 'c':
+				compile_file = optarg;
+				break;
+			case 'i':
+				compiled_input = optarg;
+				break;
+			case 'B':
+				batch_list = optarg;
+				break;
+			case 'a':
+				all_outcomes++;
+				break;
+			case 'p':
+				sparse_mode++;
+				break;
+			case 'r':
+				resamples = atoi(optarg);
+				if (resamples < 1) {
+					fprintf(stderr, "%s: -r needs a positive number of resamples\n",
+						myname);
+					errors++;
+				}
+				break;
+			case 's':
+				boot_seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				num_threads = atoi(optarg);
+				if (num_threads < 1) {
+					fprintf(stderr, "%s: -j needs a positive number of threads\n",
+						myname);
+					errors++;
+				}
+				break;
 			case 'h':
 				long_help();
 				break;
@@ -1032,64 +1588,536 @@ grok_args(int argc, char **argv)
 		}
 
 	nargs = argc - optind;
-	if (nargs > 0) {
+	if (merge_mode) {
+		if (nargs < 1) {
+			fprintf(stderr, "%s: -m needs partial tally files to merge\n",
+				myname);
+			errors++;
+		}
+		if (numeric_mode || line_mode || weighted_mode) {
+			fprintf(stderr, "%s: -m does not read ballots, so -n, -b and -w do not apply\n",
+				myname);
+			errors++;
+		}
+		if (compile_file || compiled_input) {
+			fprintf(stderr, "%s: -m does not go with -c or -i\n", myname);
+			errors++;
+		}
+		merge_files = argv + optind;
+		num_merge_files = nargs;
+	} else if (nargs > 0) {
 		fprintf(stderr, "%s: no positional arguments\n", myname);
 		errors++;
 	}
 
+	if (batch_list && (merge_mode || partial_file || compile_file || compiled_input)) {
+		fprintf(stderr, "%s: -B does not go with -m, -o, -c or -i\n", myname);
+		errors++;
+	}
+
+	if (resamples && (merge_mode || partial_file || compile_file)) {
+		fprintf(stderr, "%s: -r needs ballots to rank, so does not go with -m, -o or -c\n",
+			myname);
+		errors++;
+	}
+
+	if (sparse_mode && (merge_mode || partial_file || resamples)) {
+		fprintf(stderr, "%s: -p keeps no pairwise matrix, so does not go with -m, -o or -r\n",
+			myname);
+		errors++;
+	}
+
+	if (compiled_input && (numeric_mode || line_mode || weighted_mode)) {
+		fprintf(stderr, "%s: -i reads its input options from the file, so -n, -b and -w do not apply\n",
+			myname);
+		errors++;
+	}
+
 	if (errors)
 		usage();
 }
 
-int
-main(int argc, char **argv)
+/*
+ * Column mode input.
+ * Read, check and convert the whole file.
+ */
+static void
+input_columns(int fd)
 {
-	grok_args(argc, argv);
-	input();
+	int i;
+
+	input(fd);
+	stage("input");
 	if (debug)
 		print_sr_array();
 	icheck1();
+	for (i = 0; i < num_candidates; i++)
+		check(election_add_candidate(election, names[i], strlen(names[i])));
 	if (numeric_mode)
-		ncheck2();
+		nconv();
 	else
 		icheck2();
 	icheck3();
 	if (debug)
 		print_num_rankings();
 
-	if (verbose)
-		printf("%d candidates and %d voters found.\n",
-			num_candidates, num_voters);
-
-	if (numeric_mode)
-		nconv();
-	else
+	if (!numeric_mode)
 		iconv();
+	stage("convert");
 
 	if (debug)
 		print_ranking_array();
+}
+
+/*
+ * Start a new election, set up the way the options say.
+ */
+static void
+new_election()
+{
+	election = election_new();
+	if (!election) {
+		fprintf(errfp, "%s: out of memory\n", myname);
+		bail();
+	}
+	election_set_threads(election, batch_list ? 1 : num_threads);
+	election_set_log(election, outfp, verbose, debug);
+	election_set_stage_hook(election, stage_hook, NULL);
+	if (sparse_mode)
+		check(election_set_sparse(election));
+	if (resamples)
+		check(election_keep_ballots(election));
+	if (all_outcomes)
+		election_set_outcomes(election, OUTCOME_KBYTES);
+}
+
+/*
+ * Print each ranking that an order of the tied majorities gives (-a),
+ * on one line, best first.
+ */
+static void
+print_outcomes()
+{
+	int i, j, k, t, n, nc;
+	int *rank;
+	int *order;
+
+	nc = election_num_candidates(election);
+	n = election_num_outcomes(election);
+	rank = calloc(nc + 1, sizeof rank[0]);
+	order = calloc(nc + 1, sizeof order[0]);
+	if (!rank || !order) {
+		fprintf(errfp, "%s: out of memory\n", myname);
+		bail();
+	}
+	if (election_outcomes_cut(election))
+		fprintf(outfp, "\nAt least %d ranking%s found:\n", n, n == 1 ? " was" : "s were");
+	else
+		fprintf(outfp, "\n%d ranking%s possible:\n", n, n == 1 ? " is" : "s are");
+	for (k = 0; k < n; k++) {
+		check(election_outcome(election, k, rank));
+		for (i = 0; i < nc; i++) {
+			for (j = i; j > 0 && rank[order[j - 1]] > rank[i]; j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+		fprintf(outfp, "\t");
+		for (i = 0; i < nc; i++) {
+			t = order[i];
+			if (i)
+				fprintf(outfp, " %c ", rank[t] == rank[order[i - 1]] ? '=' : '>');
+			fprintf(outfp, "%s", election_candidate_name(election, t));
+		}
+		fprintf(outfp, "\n");
+	}
+	if (election_outcomes_cut(election))
+		fprintf(outfp, "The search stopped at its %d MB limit, so there may be more.\n",
+			OUTCOME_KBYTES / 1024);
+	free(rank);
+	free(order);
+}
+
+/*
+ * Rank the bootstrap resamples (-r), and print how often each
+ * candidate came in each place, in the order of the result.
+ */
+static void
+print_bootstrap()
+{
+	int i, j, k, t, nc;
+	int *place;
+	int *order;
+	int *rank;
+	struct election_result_s r;
+
+	nc = election_num_candidates(election);
+	place = calloc((size_t)nc * nc + 1, sizeof place[0]);
+	order = calloc(nc + 1, sizeof order[0]);
+	rank = calloc(nc + 1, sizeof rank[0]);
+	if (!place || !order || !rank) {
+		fprintf(errfp, "%s: out of memory\n", myname);
+		bail();
+	}
+	check(election_bootstrap(election, resamples, boot_seed, place));
+	stage("bootstrap");
+
+	for (i = 0; i < nc; i++) {
+		check(election_result(election, i, &r));
+		rank[i] = r.rank;
+		for (j = i; j > 0 && rank[order[j - 1]] > r.rank; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	fprintf(outfp, "\nBootstrap: the share of %d resamples in which each candidate came in each place\n",
+		resamples);
+	fprintf(outfp, "%10s", "Place");
+	for (k = 0; k < nc; k++)
+		fprintf(outfp, " %6d", k + 1);
+	fprintf(outfp, "\n");
+	for (i = 0; i < nc; i++) {
+		t = order[i];
+		fprintf(outfp, "%10s", election_candidate_name(election, t));
+		for (k = 0; k < nc; k++)
+			fprintf(outfp, " %6.3f",
+				(double)place[(size_t)t * nc + k] / resamples);
+		fprintf(outfp, "\n");
+	}
+	free(place);
+	free(order);
+	free(rank);
+}
+
+/*
+ * The input has been read into the election.  Count it, rank it
+ * and print the result, or write the partial tally.
+ */
+static void
+rank_input()
+{
+	// the column mode and compiled ballots have not been counted yet.
+	if (rankings) {
+		tally_rankings();
+		stage("tally");
+	}
+
+	// with -w, each ballot is as many voters as its count.
+	if (verbose) {
+		fprintf(outfp, "%d candidates and %d voters found.\n",
+			num_candidates, election_num_voters(election));
+		if (rankings)
+			fprintf(outfp, "%lld distinct ballots.\n",
+				election_distinct_ballots(election));
+	}
+
+	if (partial_file) {
+		write_partial();
+		exit(0);
+	}
+
+	check(election_rank(election));
+	check(election_print(election, outfp));
+	if (all_outcomes)
+		print_outcomes();
+	if (resamples)
+		print_bootstrap();
+	stage("output");
+	if (timing) {
+		fprintf(errfp, "stage\ttotal\t%.6f\t%ld\n", since(&start_time),
+			peak_kbytes());
+		print_counts();
+	}
+}
+
+/*
+ * Free everything about the input just counted, so the thread can
+ * go on to the next.
+ */
+static void
+free_input()
+{
+	int i;
+
+	election_free(election);
+	election = NULL;
+	for (i = 0; i < sr_alloc; i++)
+		free(sr[i].v);
+	for (i = 0; i < names_alloc; i++)
+		free(names[i]);
+	free(sr);
+	free(names);
+	free(num_rankings);
+	if (compiled_map)
+		munmap(compiled_map, compiled_len);
+	else {
+		free(rankings);
+		free(voter_weight);
+	}
+	reader_close(&reader);
+	sr = NULL;
+	sr_alloc = num_rows = num_columns = 0;
+	names = NULL;
+	names_alloc = num_candidates = num_voters = 0;
+	num_rankings = NULL;
+	rankings = NULL;
+	rank_width = 0;
+	voter_weight = NULL;
+	voter_weight_alloc = 0;
+	compiled_map = NULL;
+	compiled_len = 0;
+}
+
+/*
+ * Batch mode (-B).
+ * Each input listed is counted as an election of its own, by
+ * num_threads workers at once.  The output and messages of each are
+ * kept in memory, and written out in the order of the list as soon
+ * as the ones before it are done.
+ */
+struct contest_s {
+	char *file;
+	char *out;
+	size_t out_len;
+	char *err;
+	size_t err_len;
+	int failed;
+	int done;
+};
+
+struct contest_s *contests;
+int num_contests;
+int contests_alloc;
+int next_contest;
+pthread_mutex_t contest_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t contest_done = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Count one input file.  Returns -1 if it was bad.
+ */
+static int
+count_contest(char *file)
+{
+	int fd;
+	jmp_buf env;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(errfp, "%s: %s: %s\n", myname, file, strerror(errno));
+		return -1;
+	}
+	if (setjmp(env)) {
+		bail_env = NULL;
+		free_input();
+		close(fd);
+		return -1;
+	}
+	bail_env = &env;
 
-	create_majorities();
-	if (debug) {
-		check_majorities("after creating them");
-		if (debug > 1)
-			print_majorities();
-	}
-	ranking_phase = 0;
-	pull_unranked_losers();
-	while (pull_condorcet())
-		;
-	printf("%d majorities and %d majority pairings remain.  %d majority ties were found.\n",
-		num_majorities,
-		num_majorities * (num_majorities - 1) / 2,
-		count_tied_majorities());
-	ranking_tie = 0;
-	while (num_majorities) {
-		do_sort();
-		do_lock();
-		find_rp_winners();
-	}
-	if (ranking_tie)
-		printf("Ranking ties were found.  RP ranking is not unique.\n");
-	print_rankings();
+	stage(NULL);
+	new_election();
+	if (line_mode) {
+		input_ballots(fd);
+		stage("input");
+	} else
+		input_columns(fd);
+	rank_input();
+
+	bail_env = NULL;
+	free_input();
+	close(fd);
+	return 0;
+}
+
+static void *
+batch_worker(void *arg)
+{
+	int i;
+	struct contest_s *cp;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&contest_lock);
+		i = next_contest++;
+		pthread_mutex_unlock(&contest_lock);
+		if (i >= num_contests)
+			return NULL;
+		cp = &contests[i];
+		outfp = open_memstream(&cp->out, &cp->out_len);
+		errfp = open_memstream(&cp->err, &cp->err_len);
+		if (!outfp || !errfp) {
+			fprintf(stderr, "%s: out of memory\n", myname);
+			exit(1);
+		}
+		cp->failed = count_contest(cp->file) < 0;
+		fclose(outfp);
+		fclose(errfp);
+
+		pthread_mutex_lock(&contest_lock);
+		cp->done = 1;
+		pthread_cond_broadcast(&contest_done);
+		pthread_mutex_unlock(&contest_lock);
+	}
+}
+
+static void
+add_contest(char *file)
+{
+	contests = grow(contests, &contests_alloc, num_contests + 1,
+		sizeof contests[0]);
+	contests[num_contests++].file = file;
+}
+
+static int
+contest_order(const void *p, const void *q)
+{
+	const struct contest_s *cp = p;
+	const struct contest_s *cq = q;
+
+	return strcmp(cp->file, cq->file);
+}
+
+/*
+ * The inputs are the .csv files in directory list, in order of name,
+ * or else the files named in list, one per line.  - is stdin.
+ */
+static void
+read_batch_list(char *list)
+{
+	int len;
+	char *path;
+	char *line;
+	size_t cap;
+	ssize_t n;
+	struct stat st;
+	struct dirent *dp;
+	DIR *dir;
+	FILE *fp;
+
+	if (strcmp(list, "-") && stat(list, &st) == 0 && S_ISDIR(st.st_mode)) {
+		dir = opendir(list);
+		if (!dir) {
+			fprintf(errfp, "%s: %s: %s\n", myname, list, strerror(errno));
+			bail();
+		}
+		while ((dp = readdir(dir))) {
+			len = strlen(dp->d_name);
+			if (len < 5 || strcasecmp(dp->d_name + len - 4, ".csv"))
+				continue;
+			path = zalloc(strlen(list) + len + 2, 1);
+			sprintf(path, "%s/%s", list, dp->d_name);
+			add_contest(path);
+		}
+		closedir(dir);
+		qsort(contests, num_contests, sizeof contests[0], contest_order);
+		return;
+	}
+
+	fp = strcmp(list, "-") ? fopen(list, "r") : stdin;
+	if (!fp) {
+		fprintf(errfp, "%s: %s: %s\n", myname, list, strerror(errno));
+		bail();
+	}
+	line = NULL;
+	cap = 0;
+	while ((n = getline(&line, &cap, fp)) >= 0) {
+		while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+			line[--n] = '\0';
+		if (n == 0)
+			continue;
+		path = zalloc(n + 1, 1);
+		memcpy(path, line, n);
+		add_contest(path);
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+}
+
+/*
+ * Count all the inputs in batch_list.  Returns the exit status.
+ */
+static int
+run_batch()
+{
+	int i, t, nt;
+	int failed;
+	pthread_t *tid;
+	struct contest_s *cp;
+
+	read_batch_list(batch_list);
+	nt = num_threads;
+	if (nt > num_contests)
+		nt = num_contests;
+	tid = zalloc(nt, sizeof tid[0]);
+	for (t = 0; t < nt; t++)
+		if (pthread_create(&tid[t], NULL, batch_worker, NULL)) {
+			if (t == 0) {
+				fprintf(stderr, "%s: cannot create thread\n", myname);
+				exit(1);
+			}
+			nt = t;
+		}
+
+	failed = 0;
+	for (i = 0, cp = contests; i < num_contests; i++, cp++) {
+		pthread_mutex_lock(&contest_lock);
+		while (!cp->done)
+			pthread_cond_wait(&contest_done, &contest_lock);
+		pthread_mutex_unlock(&contest_lock);
+
+		printf("Contest: %s\n", cp->file);
+		fwrite(cp->out, 1, cp->out_len, stdout);
+		fflush(stdout);
+		fwrite(cp->err, 1, cp->err_len, stderr);
+		if (cp->failed) {
+			fprintf(stderr, "%s: %s was not counted\n", myname, cp->file);
+			failed++;
+		}
+		free(cp->out);
+		free(cp->err);
+	}
+	for (t = 0; t < nt; t++)
+		pthread_join(tid[t], NULL);
+	free(tid);
+	return failed ? 1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int i;
+
+	outfp = stdout;
+	errfp = stderr;
+	grok_args(argc, argv);
+	if (batch_list)
+		return run_batch();
+
+	stage(NULL);
+	new_election();
+	if (merge_mode) {
+		for (i = 0; i < num_merge_files; i++)
+			merge_partial(merge_files[i]);
+		num_candidates = election_num_candidates(election);
+		num_voters = election_num_voters(election);
+	} else if (compiled_input)
+		load_ballots(compiled_input);
+	else if (line_mode)
+		input_ballots(0);
+	else
+		input_columns(0);
+	if (merge_mode || compiled_input || line_mode)
+		stage("input");
+
+	if (compile_file) {
+		if (line_mode)
+			compile_end(compile_weights);
+		else
+			compile_rankings();
+		exit(0);
+	}
+
+	rank_input();
+	election_free(election);
+	return 0;
 }
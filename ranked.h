@@ -0,0 +1,155 @@
+/*
+ * libranked: rank candidates by the ranked pairs (Tideman) method.
+ *
+ * Everything about one election is kept in a struct election_s, so any
+ * number of them can be run in one process, each from one thread at a
+ * time.  The calls, in order:
+ *
+ *	e = election_new();
+ *	election_add_candidate(e, name, len);		once per candidate
+ *	election_add_ballot(e, pairs, n, weight);	once per ballot
+ *	election_rank(e);
+ *	election_result(e, c, &result);		or election_print()
+ *	election_free(e);
+ *
+ * A ballot is n (candidate, rank) pairs in pairs[], candidate first.
+ * Candidates are numbered from 0 in the order they were added; ranks
+ * start at 1 for the best, and may be shared.  A candidate not on the
+ * ballot is ranked below every one that is.  Ballots are counted in
+ * batches as they come; election_tally() counts the ones still waiting.
+ *
+ * The calls that can fail return -1 and leave a message for
+ * election_error().  After a failure the election can only be freed,
+ * except for calls refused before they change anything: a bad ballot
+ * given to election_add_ballot(), a call made out of order (a candidate
+ * after the first ballot, a second election_rank(), a result asked for
+ * before one) or one asking for a candidate or outcome that is not
+ * there.  Those leave the election as it was, and it goes on.
+ */
+
+#ifndef RANKED_H
+#define RANKED_H
+
+#include <stdio.h>
+
+/*
+ * How a candidate's rank was decided.
+ */
+#define	RANKING_C_WINNER	1
+#define	RANKING_C_LOSER		2
+#define	RANKING_T_WINNER	3
+#define	RANKING_T_LOSER		4
+#define	RANKING_LOSER		5
+#define	RANKING_NONE		6
+
+struct election_s;
+
+struct election_result_s {
+	int rank;	// 1 is the winner; tied candidates share a rank
+	int phase;	// from 1, the pass that ranked the candidate
+	int source;	// RANKING_*
+	int tied;	// ranked in or after a phase with tied pairings
+};
+
+/*
+ * How often the hot calls were made, for timing.
+ */
+struct election_counts_s {
+	long long name_compares;	// strcasecmp of candidate names
+	long long compar;		// majority comparisons
+	long long path_to;		// cycle checks while locking
+	long long arc_rows;		// reach rows updated while locking
+	long long remove_pairings;	// candidates taken out
+	long long compactions;		// passes dropping inactive majorities
+};
+
+struct election_s *election_new(void);
+void election_free(struct election_s *e);
+const char *election_error(struct election_s *e);
+
+/*
+ * Settings.  Count ballots with n threads.  With verbose or debug set,
+ * progress and debugging output go to fp.  fn(arg, name) is called as
+ * each stage of election_rank() finishes.
+ */
+void election_set_threads(struct election_s *e, int n);
+void election_set_log(struct election_s *e, FILE *fp, int verbose, int debug);
+void election_set_stage_hook(struct election_s *e,
+	void (*fn)(void *arg, const char *name), void *arg);
+
+/*
+ * Candidates.  All of them must be added before the first ballot.
+ * election_add_candidate() returns the new candidate's number.
+ * Names are matched ignoring case; if two are the same, the first is found.
+ */
+int election_add_candidate(struct election_s *e, const char *name, int len);
+int election_find_candidate(struct election_s *e, const char *name, int len);
+int election_num_candidates(struct election_s *e);
+const char *election_candidate_name(struct election_s *e, int c);
+
+/*
+ * Ballots.  election_num_voters() is the sum of their weights.
+ */
+int election_add_ballot(struct election_s *e, const int *pairs, int n, int weight);
+int election_tally(struct election_s *e);
+int election_num_voters(struct election_s *e);
+long long election_distinct_ballots(struct election_s *e);
+
+/*
+ * Sparse tally.  With election_set_sparse() called before the first
+ * ballot, counts are kept only for the pairs of candidates that some
+ * ballot ranks together, rather than for every pair, so the tally of
+ * an election with many candidates and short ballots is much smaller.
+ * Ranking still makes a majority for each pair of candidates ranked at
+ * all, so election_rank() needs memory that grows with their square,
+ * and refuses more than about 65000 of them.  The result is the same.
+ * It does not go with partial tallies or a bootstrap.
+ */
+int election_set_sparse(struct election_s *e);
+
+/*
+ * Bootstrap.  With election_keep_ballots() called before the first
+ * ballot, election_bootstrap() ranks n resamples of the ballots on the
+ * election's threads and sets place[c * num_candidates + k] to the
+ * number of them in which candidate c came in place k + 1.  The same
+ * seed gives the same counts.  It can be called before or after
+ * election_rank(), and does not change the election's own result.
+ */
+int election_keep_ballots(struct election_s *e);
+int election_bootstrap(struct election_s *e, int n, unsigned long long seed, int *place);
+
+/*
+ * Partial tallies: the candidates and pairwise counts, to be added up
+ * with others elsewhere.  name is used in error messages.
+ */
+int election_write_tally(struct election_s *e, FILE *fp, const char *name);
+int election_merge_tally(struct election_s *e, FILE *fp, const char *name);
+
+/*
+ * Results.  election_rank() may only be called once.
+ */
+int election_rank(struct election_s *e);
+int election_result(struct election_s *e, int c, struct election_result_s *rp);
+int election_tied(struct election_s *e);
+int election_print(struct election_s *e, FILE *fp);
+
+/*
+ * Tied outcomes.  When equal strength majorities cannot be ordered,
+ * the ranking depends on the order they were sorted in.  With
+ * election_set_outcomes(e, limit) called before election_rank(),
+ * every distinct ranking that some order of them gives is found too,
+ * building at most limit kilobytes of lock graphs while searching,
+ * and doing work in proportion to limit.
+ * The first is the one election_result() gives.  election_outcome()
+ * sets rank[c] for each candidate c, as election_result() would.
+ * election_outcomes_cut() is true if the search stopped at the limit,
+ * so there may be more.
+ */
+void election_set_outcomes(struct election_s *e, int limit);
+int election_num_outcomes(struct election_s *e);
+int election_outcome(struct election_s *e, int k, int *rank);
+int election_outcomes_cut(struct election_s *e);
+const char *election_source_name(int source);
+void election_counts(struct election_s *e, struct election_counts_s *cp);
+
+#endif